@@ -0,0 +1,153 @@
+#pragma once
+#ifndef DISCORD_BENCH_HPP
+#define DISCORD_BENCH_HPP
+
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fmt/format.h>
+
+#include <discord-rpc/coroutine.hpp>
+
+namespace discord {
+    class LoopbackTransport;
+}
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace bench {
+    /// Reads the CPU timestamp counter, or nanoseconds where there is none
+    inline uint64_t cycles() noexcept {
+        #if defined(_M_X64) || defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+        #else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()
+        ).count();
+        #endif
+    }
+
+    /// Keeps the compiler from optimizing the benchmarked work away
+    template <typename T>
+    void doNotOptimize(T const& value) noexcept {
+        [[maybe_unused]] static T const* volatile sink;
+        sink = &value;
+    }
+
+    struct Result {
+        std::string name;
+        size_t iterations;
+        double nsPerOp;
+        double cyclesPerOp;
+    };
+
+    /// Every result reported so far, written out as JSON at the end of the run
+    inline std::vector<Result>& results() noexcept {
+        static std::vector<Result> results;
+        return results;
+    }
+
+    /// Only benchmarks whose name contains this run, set from the command line
+    inline std::string& filter() noexcept {
+        static std::string filter;
+        return filter;
+    }
+
+    inline bool enabled(std::string_view name) noexcept {
+        return name.find(filter()) != std::string_view::npos;
+    }
+
+    inline void report(Result const& result) {
+        fmt::print(stderr, "{:<56} {:>12} iters {:>10.1f} ns/op {:>10.1f} cycles/op\n",
+                   result.name, result.iterations, result.nsPerOp, result.cyclesPerOp);
+        results().push_back(result);
+    }
+
+    /// Runs `fn` `iterations` times after a short warmup and reports the average cost
+    template <typename F>
+    Result run(std::string_view name, size_t iterations, F&& fn) {
+        if (!enabled(name)) {
+            return {std::string(name), 0, 0, 0};
+        }
+
+        for (size_t i = 0; i < iterations / 10 + 1; ++i) { fn(); }
+
+        auto start = std::chrono::steady_clock::now();
+        auto startCycles = cycles();
+        for (size_t i = 0; i < iterations; ++i) { fn(); }
+        auto endCycles = cycles();
+        auto end = std::chrono::steady_clock::now();
+
+        Result result{
+            std::string(name), iterations,
+            std::chrono::duration<double, std::nano>(end - start).count() / static_cast<double>(iterations),
+            static_cast<double>(endCycles - startCycles) / static_cast<double>(iterations),
+        };
+        report(result);
+        return result;
+    }
+
+    /// Value of the string field `key`, found without parsing the JSON (good enough for the library's own commands)
+    inline std::string_view findString(std::string_view json, std::string_view key) noexcept {
+        for (auto pos = json.find(key); pos != std::string_view::npos; pos = json.find(key, pos + 1)) {
+            auto rest = json.substr(pos + key.size());
+            if (pos == 0 || json[pos - 1] != '"' || !rest.starts_with(R"(":")")) {
+                continue;
+            }
+
+            rest.remove_prefix(3);
+            auto end = rest.find('"');
+            return end == std::string_view::npos ? std::string_view{} : rest.substr(0, end);
+        }
+        return {};
+    }
+
+    /// Coroutine that runs to completion on its own, used to bridge awaitables to blocking code
+    struct Detached {
+        struct promise_type {
+            Detached get_return_object() noexcept { return {}; }
+            std::suspend_never initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept { std::terminate(); }
+        };
+    };
+
+    /// Awaits `awaitable` and hands its result to `promise`
+    template <typename T>
+    Detached complete(discord::Awaitable<T> awaitable, std::promise<T>& promise) {
+        promise.set_value(co_await awaitable);
+    }
+
+    /// Blocks until the awaitable completes
+    template <typename T>
+    T wait(discord::Awaitable<T> awaitable) {
+        std::promise<T> promise;
+        auto future = promise.get_future();
+        complete(std::move(awaitable), promise);
+        return future.get();
+    }
+
+    /// Connects the RPC manager to a Discord played over `transport`, answering every command (see loopback.cpp)
+    /// @return false if no READY arrived, the manager is shut down again in that case
+    bool connectLoopback(discord::LoopbackTransport& transport);
+
+    /// Shuts the manager down and hands it back to the platform's pipe
+    void disconnectLoopback();
+
+    void runSerialization();
+    void runCommandQueue();
+    void runFraming();
+    void runLoopback();
+}
+
+#endif // DISCORD_BENCH_HPP
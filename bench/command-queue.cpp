@@ -0,0 +1,198 @@
+#include "bench.hpp"
+#include "serialization.hpp"
+
+#include <discord-rpc.hpp>
+
+#include <algorithm>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace {
+    /// The mutex-guarded queue used before the ring, kept as a baseline.
+    /// Producers serialize while holding the lock, like `prepare()`/`finish()` did.
+    class LockedQueue {
+    public:
+        template <typename F>
+        bool submit(F&& serialize) {
+            std::lock_guard lock(m_mutex);
+            serialize(m_queue.emplace());
+            return true;
+        }
+
+        bool pop(std::string& command) {
+            std::lock_guard lock(m_mutex);
+            if (m_queue.empty()) {
+                return false;
+            }
+            command = std::move(m_queue.front());
+            m_queue.pop();
+            return true;
+        }
+
+    private:
+        std::queue<std::string> m_queue;
+        std::mutex m_mutex;
+    };
+
+    /// The ring behind the same interface, producers serialize into their own buffer first like refresh() does
+    class RingQueue {
+    public:
+        template <typename F>
+        bool submit(F&& serialize) {
+            thread_local std::string buffer;
+            serialize(buffer);
+            while (!m_queue.submit(buffer)) {
+                std::this_thread::yield();
+            }
+            return true;
+        }
+
+        bool pop(std::string& command) { return m_queue.pop(command); }
+
+    private:
+        discord::CommandQueue m_queue{256};
+    };
+
+    discord::Presence makePresence() {
+        discord::Presence presence;
+        presence
+            .setState("West of House")
+            .setDetails("Frustration Level: 42")
+            .setStartTimestamp(1700000000)
+            .setLargeImageKey("canary-large")
+            .setPartyID("party1234")
+            .setPartySize(1)
+            .setPartyMax(6)
+            .setButton1("Click me!", "https://google.com/");
+        return presence;
+    }
+
+    /// Runs `producers` threads serializing and queueing presence, with a single consumer draining
+    /// the queue like the IO worker. The mutex-guarded baseline and the ring are measured the same way.
+    template <typename Queue>
+    void runContention(std::string_view kind, size_t producers, size_t perProducer) {
+        auto fullName = fmt::format("CommandQueue/contention/{}/producers:{}", kind, producers);
+        if (!bench::enabled(fullName)) {
+            return;
+        }
+
+        Queue queue;
+        auto const presence = makePresence();
+        auto const total = producers * perProducer;
+
+        auto start = std::chrono::steady_clock::now();
+        auto startCycles = bench::cycles();
+
+        std::thread consumer([&] {
+            std::string command;
+            size_t received = 0;
+            while (received < total) {
+                if (queue.pop(command)) {
+                    bench::doNotOptimize(command);
+                    ++received;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+
+        std::vector<std::thread> threads;
+        threads.reserve(producers);
+        for (size_t p = 0; p < producers; ++p) {
+            threads.emplace_back([&] {
+                for (size_t i = 0; i < perProducer; ++i) {
+                    queue.submit([&](std::string& buffer) {
+                        discord::serializePresence(buffer, presence, 1234, static_cast<int>(i));
+                    });
+                }
+            });
+        }
+
+        for (auto& thread : threads) { thread.join(); }
+        consumer.join();
+
+        auto endCycles = bench::cycles();
+        auto end = std::chrono::steady_clock::now();
+
+        bench::report({
+            fullName, total,
+            std::chrono::duration<double, std::nano>(end - start).count() / static_cast<double>(total),
+            static_cast<double>(endCycles - startCycles) / static_cast<double>(total),
+        });
+    }
+
+    /// Runs `producers` threads calling RPCManager::refresh() against a connected loopback,
+    /// so the real producer path (serialize, fingerprint, queue, wake the IO worker) is measured.
+    void runRefreshContention(size_t producers, size_t perProducer) {
+        auto fullName = fmt::format("CommandQueue/contention/refresh/producers:{}", producers);
+        if (!bench::enabled(fullName)) {
+            return;
+        }
+
+        auto& rpc = discord::RPCManager::get();
+        auto const total = producers * perProducer;
+
+        auto start = std::chrono::steady_clock::now();
+        auto startCycles = bench::cycles();
+
+        std::vector<std::thread> threads;
+        threads.reserve(producers);
+        for (size_t p = 0; p < producers; ++p) {
+            threads.emplace_back([&] {
+                for (size_t i = 0; i < perProducer; ++i) {
+                    rpc.refresh();
+                }
+            });
+        }
+        for (auto& thread : threads) { thread.join(); }
+
+        auto endCycles = bench::cycles();
+        auto end = std::chrono::steady_clock::now();
+
+        bench::report({
+            fullName, total,
+            std::chrono::duration<double, std::nano>(end - start).count() / static_cast<double>(total),
+            static_cast<double>(endCycles - startCycles) / static_cast<double>(total),
+        });
+    }
+}
+
+namespace bench {
+    void runCommandQueue() {
+        constexpr size_t perProducer = 50'000;
+
+        auto maxProducers = std::max<size_t>(std::thread::hardware_concurrency(), 8);
+        for (size_t producers = 1; producers <= maxProducers; producers *= 2) {
+            runContention<LockedQueue>("mutex", producers, perProducer);
+            runContention<RingQueue>("ring", producers, perProducer);
+        }
+
+        // connecting takes a while, skip it when the filter leaves nothing to measure
+        bool wanted = false;
+        for (size_t producers = 1; producers <= maxProducers; producers *= 2) {
+            wanted = wanted || bench::enabled(fmt::format("CommandQueue/contention/refresh/producers:{}", producers));
+        }
+        if (!wanted) {
+            return;
+        }
+
+        discord::LoopbackTransport transport;
+        if (!connectLoopback(transport)) {
+            return;
+        }
+
+        // every call has to reach the queue, otherwise only the first one would be measured
+        auto& rpc = discord::RPCManager::get();
+        rpc.setPresenceDeduplication(false);
+        rpc.getPresence() = makePresence();
+        for (size_t producers = 1; producers <= maxProducers; producers *= 2) {
+            runRefreshContention(producers, perProducer);
+        }
+
+        rpc.setPresenceDeduplication(true);
+        rpc.clearPresence();
+        disconnectLoopback();
+    }
+}
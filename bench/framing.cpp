@@ -0,0 +1,107 @@
+#include <discord-rpc.hpp>
+
+#include "bench.hpp"
+#include "flight-recorder.hpp"
+#include "rpc-connection.hpp"
+
+#include <array>
+#include <vector>
+
+namespace {
+    using discord::Connection;
+    using Frame = Connection::MessageFrame;
+
+    constexpr size_t BatchSize = discord::platform::MaxIOBuffers;
+
+    constexpr std::string_view JoinRequest = R"({"cmd":"DISPATCH","data":{"user":{"id":"53908232506183680",)"
+        R"("username":"Mason","discriminator":"1337","global_name":"Mason","avatar":"a_bab14f271d565501444b2ca3be944b25",)"
+        R"("bot":false,"flags":0,"premium_type":2}},"evt":"ACTIVITY_JOIN_REQUEST","nonce":null})";
+
+    constexpr std::string_view ActivityAck = R"({"cmd":"SET_ACTIVITY","data":{"state":"West of House",)"
+        R"("details":"Frustration Level: 42","timestamps":{"start":1700000000},"assets":{"large_image":"canary-large"},)"
+        R"("name":"Test","application_id":"345229890980937739","type":0},"evt":null,"nonce":"1234"})";
+
+    /// A receive buffer holding `BatchSize` frames with the given payload
+    std::vector<uint8_t> makeReceiveBuffer(std::string_view payload) {
+        std::vector<uint8_t> buffer;
+        for (size_t i = 0; i < BatchSize; ++i) {
+            auto offset = buffer.size();
+            buffer.resize(offset + Frame::HeaderSize + payload.size());
+            Frame::writeHeader(buffer.data() + offset, Connection::Opcode::Frame, payload.size());
+            std::memcpy(buffer.data() + offset + Frame::HeaderSize, payload.data(), payload.size());
+        }
+        return buffer;
+    }
+
+    /// Walks the frames like Connection::read, handing each payload to `fn`
+    template <typename F>
+    void decodeFrames(std::vector<uint8_t> const& buffer, F&& fn) {
+        size_t offset = 0;
+        while (offset + Frame::HeaderSize <= buffer.size()) {
+            Connection::Opcode opcode;
+            uint32_t length;
+            Frame::readHeader(buffer.data() + offset, opcode, length);
+            fn(opcode, std::string_view(reinterpret_cast<char const*>(buffer.data() + offset + Frame::HeaderSize), length));
+            offset += Frame::HeaderSize + length;
+        }
+    }
+}
+
+namespace bench {
+    void runFraming() {
+        constexpr size_t iterations = 100'000;
+        constexpr glz::opts opts{.error_on_unknown_keys = false, .null_terminated = false};
+
+        // encode: fill the headers of a drained batch in place and gather it for one vectored write
+        discord::Presence presence;
+        presence.setState("West of House").setDetails("Frustration Level: 42").setLargeImageKey("canary-large");
+        std::vector<discord::CommandQueue::Entry> batch(BatchSize);
+        for (auto& entry : batch) {
+            discord::serializePresence(entry.command, presence, 1234, 1);
+        }
+
+        run("Connection/encode/batch:16", iterations, [&] {
+            std::array<discord::platform::IOBuffer, BatchSize> buffers;
+            for (size_t i = 0; i < batch.size(); ++i) {
+                auto& frame = batch[i].command;
+                Frame::writeHeader(frame.data(), Connection::Opcode::Frame, frame.size() - Frame::HeaderSize);
+                buffers[i] = {frame.data(), frame.size()};
+            }
+            doNotOptimize(buffers);
+        });
+
+        // decode: split a receive buffer into frames and parse them in place
+        auto joinRequests = makeReceiveBuffer(JoinRequest);
+        auto acks = makeReceiveBuffer(ActivityAck);
+
+        run("Connection/decode/headers/batch:16", iterations, [&] {
+            decodeFrames(acks, [](auto opcode, std::string_view payload) {
+                doNotOptimize(opcode);
+                doNotOptimize(payload);
+            });
+        });
+
+        run("Connection/decode/response/batch:16", iterations, [&] {
+            decodeFrames(acks, [&](auto, std::string_view payload) {
+                discord::EventPacket packet;
+                doNotOptimize(glz::read<opts>(packet, payload));
+                doNotOptimize(packet);
+            });
+        });
+
+        run("Connection/decode/joinRequest/batch:16", iterations, [&] {
+            discord::JoinRequestEvent event;
+            decodeFrames(joinRequests, [&](auto, std::string_view payload) {
+                discord::EventPacket packet;
+                if (!glz::read<opts>(packet, payload)) {
+                    doNotOptimize(glz::read<opts>(event, packet.data.str));
+                }
+                doNotOptimize(event);
+            });
+        });
+
+        run("FlightRecorder/findNonce/response", iterations, [&] {
+            doNotOptimize(discord::FlightRecorder::findNonce(ActivityAck));
+        });
+    }
+}
@@ -0,0 +1,123 @@
+#include <discord-rpc.hpp>
+
+#include "bench.hpp"
+#include "rpc-connection.hpp"
+
+#include <algorithm>
+#include <deque>
+#include <future>
+#include <string>
+
+namespace {
+    using discord::Connection;
+    using Frame = Connection::MessageFrame;
+
+    constexpr std::string_view Ready = R"({"cmd":"DISPATCH","data":{"v":1,"user":{"id":"1045800378228281345",)"
+        R"("username":"loopback","discriminator":"0","global_name":null,"avatar":null,"bot":false,"flags":0,)"
+        R"("premium_type":0}},"evt":"READY","nonce":null})";
+
+    /// Plays Discord on the other end of the loopback, answering on the library's thread as frames arrive
+    class Responder {
+    public:
+        void operator()(discord::LoopbackTransport& transport) {
+            transport.peerRead(m_input);
+
+            size_t offset = 0;
+            while (m_input.size() - offset >= Frame::HeaderSize) {
+                Connection::Opcode opcode;
+                uint32_t length;
+                Frame::readHeader(m_input.data() + offset, opcode, length);
+                if (m_input.size() - offset < Frame::HeaderSize + length) {
+                    break;
+                }
+
+                std::string_view payload(m_input.data() + offset + Frame::HeaderSize, length);
+                offset += Frame::HeaderSize + length;
+
+                if (opcode == Connection::Opcode::Handshake) {
+                    transport.peerWriteFrame(uint32_t(Connection::Opcode::Frame), Ready);
+                } else if (opcode == Connection::Opcode::Frame) {
+                    m_output.clear();
+                    fmt::format_to(
+                        std::back_inserter(m_output), R"({{"cmd":"{}","data":{{}},"evt":null,"nonce":"{}"}})",
+                        bench::findString(payload, "cmd"), bench::findString(payload, "nonce")
+                    );
+                    transport.peerWriteFrame(uint32_t(Connection::Opcode::Frame), m_output);
+                }
+            }
+            m_input.erase(0, offset);
+        }
+
+    private:
+        std::string m_input;
+        std::string m_output;
+    };
+}
+
+namespace bench {
+    bool connectLoopback(discord::LoopbackTransport& transport) {
+        transport.setPeerHandler(Responder{});
+
+        std::promise<void> ready;
+        auto& rpc = discord::RPCManager::get();
+        rpc.setClientID("345229890980937739")
+            .setTransport(&transport)
+            .setRateLimit(0, {})
+            .onReady([&](discord::User const&) { ready.set_value(); });
+        rpc.initialize();
+
+        bool connected = ready.get_future().wait_for(std::chrono::seconds(5)) == std::future_status::ready;
+        if (!connected) {
+            fmt::print(stderr, "Loopback: no READY\n");
+            disconnectLoopback();
+        }
+        rpc.onReady(nullptr);
+        return connected;
+    }
+
+    void disconnectLoopback() {
+        // the pipe takes over again once the loopback connection is closed
+        auto& rpc = discord::RPCManager::get();
+        rpc.setTransport(nullptr);
+        rpc.shutdown();
+    }
+
+    /// The whole protocol stack (serialization, queue, framing, response matching) over an in-memory
+    /// transport, so what's measured is the library's own cost and the IO worker's wakeups, not the socket
+    void runLoopback() {
+        constexpr std::string_view names[] = {
+            "Loopback/command/round-trip", "Loopback/command/pipelined:64", "Loopback/presence/round-trip",
+        };
+        if (std::none_of(std::begin(names), std::end(names), enabled)) {
+            return;
+        }
+
+        discord::LoopbackTransport transport;
+        if (!connectLoopback(transport)) {
+            return;
+        }
+        auto& rpc = discord::RPCManager::get();
+
+        run(names[0], 20'000, [&] {
+            doNotOptimize(rpc.sendCommand("GET_SELECTED_VOICE_CHANNEL").get());
+        });
+
+        run(names[1], 1'000, [&] {
+            std::deque<std::future<discord::CommandResponse>> inFlight;
+            for (size_t i = 0; i < 64; ++i) {
+                inFlight.push_back(rpc.sendCommand("GET_SELECTED_VOICE_CHANNEL"));
+            }
+            for (auto& response : inFlight) {
+                doNotOptimize(response.get());
+            }
+        });
+
+        size_t update = 0;
+        run(names[2], 20'000, [&] {
+            rpc.getPresence().setState("West of House").setDetails(fmt::format("Update {}", update++));
+            doNotOptimize(wait(rpc.refreshAsync()));
+        });
+
+        disconnectLoopback();
+    }
+}
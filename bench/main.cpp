@@ -0,0 +1,72 @@
+#include "bench.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+namespace {
+    /// Writes all results in a flat JSON document, one object per benchmark
+    bool writeJson(char const* path) {
+        auto* file = std::strcmp(path, "-") == 0 ? stdout : std::fopen(path, "w");
+        if (!file) {
+            fmt::print(stderr, "Failed to open {}\n", path);
+            return false;
+        }
+
+        fmt::print(file, "{{\n  \"context\": {{\"compiler\": \"{}\", \"debug\": {}}},\n  \"benchmarks\": [",
+            #if defined(__clang__)
+            fmt::format("clang {}.{}", __clang_major__, __clang_minor__),
+            #elif defined(__GNUC__)
+            fmt::format("gcc {}.{}", __GNUC__, __GNUC_MINOR__),
+            #elif defined(_MSC_VER)
+            fmt::format("msvc {}", _MSC_VER),
+            #else
+            "unknown",
+            #endif
+            #ifdef NDEBUG
+            "false"
+            #else
+            "true"
+            #endif
+        );
+
+        bool first = true;
+        for (auto const& result : bench::results()) {
+            fmt::print(file,
+                "{}\n    {{\"name\": \"{}\", \"iterations\": {}, \"ns_per_op\": {:.3f}, \"cycles_per_op\": {:.3f}}}",
+                first ? "" : ",", result.name, result.iterations, result.nsPerOp, result.cyclesPerOp
+            );
+            first = false;
+        }
+        fmt::print(file, "\n  ]\n}}\n");
+
+        if (file != stdout) {
+            std::fclose(file);
+        }
+        return true;
+    }
+}
+
+/// Usage: discord-rpc-bench [--filter <substring>] [--json <path|->]
+int main(int argc, char** argv) {
+    char const* json = nullptr;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--filter") == 0) {
+            bench::filter() = argv[i + 1];
+        } else if (std::strcmp(argv[i], "--json") == 0) {
+            json = argv[i + 1];
+        } else {
+            fmt::print(stderr, "Unknown option {}\n", argv[i]);
+            return 1;
+        }
+    }
+
+    bench::runSerialization();
+    bench::runCommandQueue();
+    bench::runFraming();
+    bench::runLoopback();
+
+    if (json && !writeJson(json)) {
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,369 @@
+#include "mock-server.hpp"
+#include "bench.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <fmt/format.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace bench {
+    namespace {
+        constexpr size_t HeaderSize = sizeof(uint32_t) * 2;
+        constexpr size_t MaxFrameSize = 64 * 1024;
+        constexpr auto ChunkInterval = std::chrono::milliseconds(1); ///< Gap between the pieces of a chunked reply
+
+        #ifdef MSG_NOSIGNAL
+        constexpr int SendFlags = MSG_NOSIGNAL;
+        #else
+        constexpr int SendFlags = 0;
+        #endif
+    }
+
+    MockServer::MockServer(std::string path, Options options)
+        : m_path(std::move(path)), m_options(options) {}
+
+    MockServer::~MockServer() {
+        stop();
+    }
+
+    bool MockServer::start() {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (m_path.size() >= sizeof(address.sun_path)) {
+            return false;
+        }
+        std::memcpy(address.sun_path, m_path.c_str(), m_path.size() + 1);
+
+        ::unlink(m_path.c_str());
+        m_listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (m_listener == -1) {
+            return false;
+        }
+
+        if (::bind(m_listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+            || ::listen(m_listener, 4) != 0) {
+            ::close(m_listener);
+            m_listener = -1;
+            return false;
+        }
+
+        if (::pipe(m_wake) != 0) {
+            ::close(m_listener);
+            m_listener = -1;
+            return false;
+        }
+        for (int fd : m_wake) {
+            ::fcntl(fd, F_SETFL, O_NONBLOCK);
+            ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+
+        m_running.store(true);
+        m_thread = std::thread([this] { run(); });
+        return true;
+    }
+
+    void MockServer::stop() {
+        m_running.store(false);
+        if (m_thread.joinable()) {
+            wake();
+            m_thread.join();
+        }
+
+        for (int& fd : m_wake) {
+            if (fd != -1) { ::close(fd); fd = -1; }
+        }
+
+        if (m_client != -1) { ::close(m_client); m_client = -1; }
+        if (m_listener != -1) {
+            ::close(m_listener);
+            m_listener = -1;
+            ::unlink(m_path.c_str());
+        }
+    }
+
+    void MockServer::setOptions(Options const& options) {
+        {
+            std::lock_guard lock(m_mutex);
+            m_options = options;
+        }
+        wake();
+    }
+
+    void MockServer::disconnect() {
+        {
+            std::lock_guard lock(m_mutex);
+            m_dropRequested = true;
+        }
+        wake();
+    }
+
+    void MockServer::close(int code, std::string_view message) {
+        {
+            std::lock_guard lock(m_mutex);
+            queueFrame(Opcode::Close, fmt::format(R"({{"code":{},"message":"{}"}})", code, message), true);
+            m_output.back().dropAfter = true;
+        }
+        wake();
+    }
+
+    void MockServer::dispatch(std::string_view event, std::string_view data) {
+        {
+            std::lock_guard lock(m_mutex);
+            queueFrame(Opcode::Frame, fmt::format(R"({{"cmd":"DISPATCH","data":{},"evt":"{}","nonce":null}})", data, event));
+        }
+        wake();
+    }
+
+    void MockServer::wake() {
+        char byte = 1;
+        [[maybe_unused]] auto res = ::write(m_wake[1], &byte, sizeof(byte));
+    }
+
+    short MockServer::clientEvents(Clock::time_point now) const {
+        short events = 0;
+        if (now >= m_nextRead) {
+            events |= POLLIN;
+        }
+        if (!m_output.empty() && m_output.front().due <= now) {
+            events |= POLLOUT;
+        }
+        return events;
+    }
+
+    int MockServer::pollTimeout(Clock::time_point now) const {
+        if (m_client == -1) {
+            return -1;
+        }
+
+        // whatever becomes due next: the front reply, a throttled read or a ping
+        auto deadline = Clock::time_point::max();
+        if (!m_output.empty() && m_output.front().due > now) {
+            deadline = m_output.front().due;
+        }
+        if (m_nextRead > now) {
+            deadline = std::min(deadline, m_nextRead);
+        }
+        if (m_options.pingInterval.count() > 0) {
+            deadline = std::min(deadline, m_nextPing);
+        }
+
+        if (deadline == Clock::time_point::max()) {
+            return -1;
+        }
+        auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - now);
+        return static_cast<int>(std::max<int64_t>(left.count(), 0));
+    }
+
+    void MockServer::run() {
+        while (m_running.load()) {
+            std::array<pollfd, 2> fds{};
+            int timeout;
+            {
+                std::lock_guard lock(m_mutex);
+                auto now = Clock::now();
+                fds[0] = {m_wake[0], POLLIN, 0};
+                if (m_client == -1) {
+                    fds[1] = {m_listener, POLLIN, 0};
+                } else {
+                    // a throttled client isn't polled at all, a hangup would keep waking the loop until the next read
+                    auto events = clientEvents(now);
+                    fds[1] = {events ? m_client : -1, events, 0};
+                }
+                timeout = m_dropRequested ? 0 : pollTimeout(now);
+            }
+
+            ::poll(fds.data(), fds.size(), timeout);
+            if (fds[0].revents & POLLIN) {
+                char buffer[64];
+                while (::read(m_wake[0], buffer, sizeof(buffer)) > 0) {}
+            }
+
+            std::lock_guard lock(m_mutex);
+            if (m_client == -1) {
+                acceptClient();
+                continue;
+            }
+
+            if (m_dropRequested) {
+                dropClient();
+                continue;
+            }
+
+            auto now = Clock::now();
+            if (m_options.pingInterval.count() > 0 && now >= m_nextPing) {
+                queueFrame(Opcode::Ping, R"({"ping":true})", true);
+                m_nextPing = now + m_options.pingInterval;
+            }
+
+            readClient();
+            if (m_client != -1) {
+                writeClient();
+            }
+        }
+    }
+
+    void MockServer::acceptClient() {
+        m_client = ::accept4(m_listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (m_client == -1) {
+            return;
+        }
+
+        m_input.clear();
+        m_output.clear();
+        m_outputOffset = 0;
+        m_clientFrames = 0;
+        m_dropRequested = false;
+        m_nextRead = Clock::now();
+        m_nextPing = Clock::now() + m_options.pingInterval;
+        m_connections.fetch_add(1);
+    }
+
+    void MockServer::readClient() {
+        auto now = Clock::now();
+        if (now < m_nextRead) {
+            return;
+        }
+
+        uint8_t buffer[MaxFrameSize];
+        auto capacity = m_options.readChunk ? std::min(m_options.readChunk, sizeof(buffer)) : sizeof(buffer);
+        auto received = ::recv(m_client, buffer, capacity, 0);
+        if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            dropClient();
+            return;
+        }
+        if (received < 0) {
+            return;
+        }
+
+        m_nextRead = now + m_options.readDelay;
+        m_input.insert(m_input.end(), buffer, buffer + received);
+
+        size_t offset = 0;
+        while (m_client != -1 && m_input.size() - offset >= HeaderSize) {
+            uint32_t opcode;
+            uint32_t length;
+            std::memcpy(&opcode, m_input.data() + offset, sizeof(opcode));
+            std::memcpy(&length, m_input.data() + offset + sizeof(opcode), sizeof(length));
+            if (length > MaxFrameSize - HeaderSize) {
+                dropClient();
+                return;
+            }
+            if (m_input.size() - offset < HeaderSize + length) {
+                break;
+            }
+
+            std::string_view payload(reinterpret_cast<char const*>(m_input.data() + offset + HeaderSize), length);
+            offset += HeaderSize + length;
+            handleFrame(static_cast<Opcode>(opcode), payload);
+        }
+
+        if (m_client != -1) {
+            m_input.erase(m_input.begin(), m_input.begin() + static_cast<std::ptrdiff_t>(offset));
+        }
+    }
+
+    void MockServer::handleFrame(Opcode opcode, std::string_view payload) {
+        m_framesReceived.fetch_add(1);
+        ++m_clientFrames;
+
+        switch (opcode) {
+            case Opcode::Handshake: {
+                queueFrame(Opcode::Frame, R"({"cmd":"DISPATCH","data":{"v":1,"config":{"cdn_host":"cdn.discordapp.com",)"
+                    R"("api_endpoint":"//discord.com/api","environment":"production"},"user":{"id":"1045800378228281345",)"
+                    R"("username":"mock","discriminator":"0","global_name":"Mock","avatar":null,"bot":false,"flags":0,)"
+                    R"("premium_type":0}},"evt":"READY","nonce":null})");
+            } break;
+            case Opcode::Frame: {
+                auto command = findString(payload, "cmd");
+                auto nonce = findString(payload, "nonce");
+                if (command == "SUBSCRIBE" || command == "UNSUBSCRIBE") {
+                    queueFrame(Opcode::Frame, fmt::format(
+                        R"({{"cmd":"{}","data":{{"evt":"{}"}},"evt":null,"nonce":"{}"}})",
+                        command, findString(payload, "evt"), nonce
+                    ));
+                } else {
+                    queueFrame(Opcode::Frame, fmt::format(R"({{"cmd":"{}","data":{{}},"evt":null,"nonce":"{}"}})", command, nonce));
+                }
+            } break;
+            case Opcode::Ping: {
+                queueFrame(Opcode::Pong, payload, true);
+            } break;
+            case Opcode::Close: {
+                dropClient();
+                return;
+            }
+            case Opcode::Pong:
+            default: break;
+        }
+
+        if (m_options.dropAfterFrames && m_clientFrames >= m_options.dropAfterFrames) {
+            dropClient();
+        }
+    }
+
+    void MockServer::writeClient() {
+        auto now = Clock::now();
+        while (!m_output.empty() && m_output.front().due <= now) {
+            auto& frame = m_output.front();
+            auto remaining = frame.bytes.size() - m_outputOffset;
+            auto chunk = m_options.writeChunk ? std::min(m_options.writeChunk, remaining) : remaining;
+
+            auto sent = ::send(m_client, frame.bytes.data() + m_outputOffset, chunk, SendFlags);
+            if (sent < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    dropClient();
+                }
+                return;
+            }
+
+            m_outputOffset += static_cast<size_t>(sent);
+            if (m_outputOffset < frame.bytes.size()) {
+                // with writeChunk set, the rest goes out a little later so the client sees partial frames
+                frame.due = now + ChunkInterval;
+                return;
+            }
+
+            bool drop = frame.dropAfter;
+            m_output.pop_front();
+            m_outputOffset = 0;
+            if (drop) {
+                dropClient();
+                return;
+            }
+        }
+    }
+
+    void MockServer::queueFrame(Opcode opcode, std::string_view payload, bool immediate) {
+        Outgoing frame;
+        frame.due = Clock::now() + (immediate ? std::chrono::milliseconds(0) : m_options.latency);
+        if (!m_output.empty()) {
+            // replies never overtake each other
+            frame.due = std::max(frame.due, m_output.back().due);
+        }
+
+        frame.bytes.resize(HeaderSize + payload.size());
+        auto code = static_cast<uint32_t>(opcode);
+        auto length = static_cast<uint32_t>(payload.size());
+        std::memcpy(frame.bytes.data(), &code, sizeof(code));
+        std::memcpy(frame.bytes.data() + sizeof(code), &length, sizeof(length));
+        std::memcpy(frame.bytes.data() + HeaderSize, payload.data(), payload.size());
+        m_output.push_back(std::move(frame));
+    }
+
+    void MockServer::dropClient() {
+        if (m_client != -1) {
+            ::close(m_client);
+            m_client = -1;
+        }
+        m_input.clear();
+        m_output.clear();
+        m_outputOffset = 0;
+        m_dropRequested = false;
+    }
+}
@@ -0,0 +1,105 @@
+#pragma once
+#ifndef DISCORD_BENCH_MOCK_SERVER_HPP
+#define DISCORD_BENCH_MOCK_SERVER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace bench {
+    /// Faults injected by `MockServer`
+    struct MockServerOptions {
+        std::chrono::milliseconds latency{0};      ///< Delay before every reply
+        size_t writeChunk = 0;                     ///< Send replies in pieces of this size (partial frames), 0 for whole
+        size_t readChunk = 0;                      ///< Read at most this many bytes per wakeup, 0 for everything
+        std::chrono::milliseconds readDelay{0};    ///< Pause between reads, together with readChunk throttles the client
+        std::chrono::milliseconds pingInterval{0}; ///< Send PING this often, 0 to never
+        size_t dropAfterFrames = 0;                ///< Drop the connection after this many received frames, 0 to never
+    };
+
+    /// Stand-in for the Discord client's IPC server, speaking the framing in `rpc-connection.hpp`.
+    /// Accepts one client at a time on a Unix socket, answers the handshake with READY and every
+    /// command with a response carrying its nonce. Faults can be injected through `Options`.
+    /// The server thread sleeps in poll() until the socket is ready or the next reply, read or ping is due,
+    /// so its own wakeups don't add latency to what's measured.
+    class MockServer {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        using Options = MockServerOptions;
+
+        explicit MockServer(std::string path, Options options = {});
+        ~MockServer();
+
+        MockServer(MockServer const&) = delete;
+        MockServer& operator=(MockServer const&) = delete;
+
+        /// Binds the socket and starts serving on a background thread
+        bool start();
+        void stop();
+
+        void setOptions(Options const& options);
+
+        /// Drops the current client without a CLOSE frame, like a crashing Discord
+        void disconnect();
+
+        /// Sends a CLOSE frame and drops the client
+        void close(int code, std::string_view message);
+
+        /// Sends a DISPATCH event, `data` is a JSON object
+        void dispatch(std::string_view event, std::string_view data);
+
+        [[nodiscard]] size_t connections() const noexcept { return m_connections.load(); }
+        [[nodiscard]] size_t framesReceived() const noexcept { return m_framesReceived.load(); }
+        [[nodiscard]] std::string const& path() const noexcept { return m_path; }
+
+    private:
+        enum class Opcode : uint32_t { Handshake = 0, Frame = 1, Close = 2, Ping = 3, Pong = 4 };
+
+        struct Outgoing {
+            Clock::time_point due;
+            std::string bytes;
+            bool dropAfter = false; ///< Drop the client once this frame is out (CLOSE)
+        };
+
+        void run();
+        void wake();
+        short clientEvents(Clock::time_point now) const;
+        int pollTimeout(Clock::time_point now) const;
+        void acceptClient();
+        void readClient();
+        void writeClient();
+        void handleFrame(Opcode opcode, std::string_view payload);
+        void queueFrame(Opcode opcode, std::string_view payload, bool immediate = false);
+        void dropClient();
+
+        std::string m_path;
+        Options m_options;
+        std::mutex m_mutex; ///< Guards the options, the outgoing queue and the pending actions
+
+        int m_listener = -1;
+        int m_client = -1;
+        int m_wake[2] = {-1, -1}; ///< Pipe that interrupts poll() for stop() and the actions above
+        std::thread m_thread;
+        std::atomic_bool m_running = false;
+
+        std::vector<uint8_t> m_input;
+        std::deque<Outgoing> m_output;
+        size_t m_outputOffset = 0; ///< Bytes of the front frame already sent
+        Clock::time_point m_nextRead{};
+        Clock::time_point m_nextPing{};
+        size_t m_clientFrames = 0;
+        bool m_dropRequested = false;
+
+        std::atomic<size_t> m_connections = 0;
+        std::atomic<size_t> m_framesReceived = 0;
+    };
+}
+
+#endif // DISCORD_BENCH_MOCK_SERVER_HPP
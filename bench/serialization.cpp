@@ -0,0 +1,329 @@
+#include "bench.hpp"
+#include "serialization.hpp"
+
+#include <discord-rpc.hpp>
+
+#include <array>
+
+// The reflection-based writer that was used before the streaming one, kept as a baseline.
+namespace legacy {
+    struct Timestamps {
+        std::optional<int64_t> start;
+        std::optional<int64_t> end;
+        constexpr Timestamps(int64_t start, int64_t end) noexcept {
+            if (start) { this->start = start; }
+            if (end) { this->end = end; }
+        }
+    };
+
+    struct Assets {
+        std::optional<std::string_view> large_image;
+        std::optional<std::string_view> large_text;
+        std::optional<std::string_view> small_image;
+        std::optional<std::string_view> small_text;
+        constexpr Assets(
+            std::string_view large_image,
+            std::string_view large_text,
+            std::string_view small_image,
+            std::string_view small_text
+        ) noexcept {
+            if (!large_image.empty()) { this->large_image = large_image; }
+            if (!large_text.empty()) { this->large_text = large_text; }
+            if (!small_image.empty()) { this->small_image = small_image; }
+            if (!small_text.empty()) { this->small_text = small_text; }
+        }
+    };
+
+    struct Party {
+        std::optional<std::string_view> id;
+        std::optional<std::array<int, 2>> size;
+        discord::PartyPrivacy privacy;
+
+        constexpr Party(
+            std::string const& id,
+            int size, int max,
+            discord::PartyPrivacy privacy
+        ) noexcept : privacy(privacy) {
+            if (!id.empty()) { this->id = id; }
+            if (size && max) { this->size = std::array{size, max}; }
+        }
+    };
+
+    struct Secrets {
+        std::optional<std::string_view> match;
+        std::optional<std::string_view> join;
+        std::optional<std::string_view> spectate;
+        constexpr Secrets(
+            std::string_view match,
+            std::string_view join,
+            std::string_view spectate
+        ) noexcept {
+            if (!match.empty()) { this->match = match; }
+            if (!join.empty()) { this->join = join; }
+            if (!spectate.empty()) { this->spectate = spectate; }
+        }
+    };
+
+    struct Button {
+        std::string_view label;
+        std::string_view url;
+        constexpr Button(std::string_view label, std::string_view url) noexcept : label(label), url(url) {}
+    };
+}
+
+template <>
+struct glz::meta<legacy::Timestamps> {
+    using T = legacy::Timestamps;
+    static constexpr auto value = object(
+        "start", &T::start,
+        "end", &T::end
+    );
+};
+
+template <>
+struct glz::meta<legacy::Assets> {
+    using T = legacy::Assets;
+    static constexpr auto value = object(
+        "large_image", &T::large_image,
+        "large_text", &T::large_text,
+        "small_image", &T::small_image,
+        "small_text", &T::small_text
+    );
+};
+
+template <>
+struct glz::meta<legacy::Party> {
+    using T = legacy::Party;
+    static constexpr auto value = object(
+        "id", &T::id,
+        "size", &T::size,
+        "privacy", &T::privacy
+    );
+};
+
+template <>
+struct glz::meta<legacy::Secrets> {
+    using T = legacy::Secrets;
+    static constexpr auto value = object(
+        "match", &T::match,
+        "join", &T::join,
+        "spectate", &T::spectate
+    );
+};
+
+template <>
+struct glz::meta<legacy::Button> {
+    using T = legacy::Button;
+    static constexpr auto value = object(
+        "label", &T::label,
+        "url", &T::url
+    );
+};
+
+template <>
+struct glz::meta<discord::Presence> {
+    using T = discord::Presence;
+    static constexpr auto value = object(
+        "state", [](auto&& self) -> std::optional<std::string_view> {
+            if (self.getState().empty()) {
+                return std::nullopt;
+            }
+            return self.getState();
+        },
+        "details", [](auto&& self) -> std::optional<std::string_view> {
+            if (self.getDetails().empty()) {
+                return std::nullopt;
+            }
+            return self.getDetails();
+        },
+        "timestamps", [](auto&& self) -> std::optional<legacy::Timestamps> {
+            auto start = self.getStartTimestamp();
+            auto end = self.getEndTimestamp();
+
+            if (start || end) {
+                return legacy::Timestamps {start, end};
+            }
+
+            return std::nullopt;
+        },
+        "assets", [](auto&& self) -> std::optional<legacy::Assets> {
+            auto& large_image = self.getLargeImageKey();
+            auto& large_text = self.getLargeImageText();
+            auto& small_image = self.getSmallImageKey();
+            auto& small_text = self.getSmallImageText();
+
+            if (!large_image.empty() || !large_text.empty() || !small_image.empty() || !small_text.empty()) {
+                return legacy::Assets {large_image, large_text, small_image, small_text};
+            }
+
+            return std::nullopt;
+        },
+        "party", [](auto&& self) -> std::optional<legacy::Party> {
+            auto& id = self.getPartyID();
+            auto size = self.getPartySize();
+            auto max = self.getPartyMax();
+            auto privacy = self.getPartyPrivacy();
+
+            if (!id.empty() || size || max || privacy != discord::PartyPrivacy::Private) {
+                return legacy::Party {id, size, max, privacy};
+            }
+
+            return std::nullopt;
+        },
+        "secrets", [](auto&& self) -> std::optional<legacy::Secrets> {
+            auto& match = self.getMatchSecret();
+            auto& join = self.getJoinSecret();
+            auto& spectate = self.getSpectateSecret();
+
+            if (!match.empty() || !join.empty() || !spectate.empty()) {
+                return legacy::Secrets {match, join, spectate};
+            }
+
+            return std::nullopt;
+        },
+        "buttons", [](auto&& self) -> std::optional<std::vector<legacy::Button>> {
+            auto& btn1 = self.getButton1();
+            auto& btn2 = self.getButton2();
+
+            if (!btn1.isEnabled() && !btn2.isEnabled()) {
+                return std::nullopt;
+            }
+
+            // if secrets are set, buttons are disabled
+            if (!self.getMatchSecret().empty() || !self.getJoinSecret().empty() || !self.getSpectateSecret().empty()) {
+                return std::nullopt;
+            }
+
+            std::vector<legacy::Button> buttons;
+            buttons.reserve(2);
+            if (btn1.isEnabled()) { buttons.emplace_back(btn1.getLabel(), btn1.getURL()); }
+            if (btn2.isEnabled()) { buttons.emplace_back(btn2.getLabel(), btn2.getURL()); }
+
+            return buttons;
+        },
+        "instance", [](auto&& self) { return self.getInstance(); },
+        "type", [](auto&& self) { return self.getActivityType(); },
+        "status_display_type", [](auto&& self) { return self.getStatusDisplayType(); }
+    );
+};
+
+namespace {
+    discord::Presence makeSmall() {
+        discord::Presence presence;
+        presence.setState("In menus");
+        return presence;
+    }
+
+    discord::Presence makeTypical() {
+        discord::Presence presence;
+        presence
+            .setState("West of House")
+            .setDetails("Frustration Level: 42")
+            .setStartTimestamp(1700000000)
+            .setEndTimestamp(1700000300)
+            .setLargeImageKey("canary-large")
+            .setSmallImageKey("ptb-small")
+            .setPartyID("party1234")
+            .setPartySize(1)
+            .setPartyMax(6)
+            .setPartyPrivacy(discord::PartyPrivacy::Public)
+            .setButton1("Click me!", "https://google.com/")
+            .setButton2("Dont click me!", "https://www.youtube.com/watch?v=dQw4w9WgXcQ");
+        return presence;
+    }
+
+    /// Every field at Discord's length limit, full of characters that need escaping
+    discord::Presence makeMaximal() {
+        auto text = [](size_t length) {
+            std::string value;
+            while (value.size() < length) { value += "\"quoted\" \\ tab\t "; }
+            value.resize(length);
+            return value;
+        };
+
+        discord::Presence presence;
+        presence
+            .setState(text(128))
+            .setDetails(text(128))
+            .setStartTimestamp(1700000000)
+            .setEndTimestamp(1700000300)
+            .setLargeImageKey(text(128))
+            .setLargeImageText(text(128))
+            .setSmallImageKey(text(128))
+            .setSmallImageText(text(128))
+            .setPartyID(text(128))
+            .setPartySize(1)
+            .setPartyMax(6)
+            .setPartyPrivacy(discord::PartyPrivacy::Public)
+            .setMatchSecret(text(128))
+            .setJoinSecret(text(128))
+            .setSpectateSecret(text(128))
+            .setInstance(true);
+        return presence;
+    }
+
+    void legacySerialize(std::string& buffer, discord::Presence const& presence, size_t pid, int nonce) {
+        auto res = glz::write<glz::opts{.error_on_unknown_keys = false}>(presence);
+        if (!res) {
+            buffer = "";
+            return;
+        }
+
+        buffer = fmt::format(
+            R"({{"nonce":"{}","cmd":"SET_ACTIVITY","args":{{"pid":{},"activity":{}}}}})",
+            nonce, pid, res.value()
+        );
+    }
+}
+
+namespace bench {
+    void runSerialization() {
+        constexpr size_t iterations = 200'000;
+
+        for (auto& [name, presence] : {
+            std::pair{"small", makeSmall()},
+            std::pair{"typical", makeTypical()},
+            std::pair{"maximal", makeMaximal()},
+        }) {
+            if (!enabled(fmt::format("serializePresence/{}/", name))) {
+                continue;
+            }
+
+            std::string buffer;
+            std::string before;
+            legacySerialize(before, presence, 1234, 1);
+            discord::serializePresence(buffer, presence, 1234, 1);
+            if (std::string_view(buffer).substr(discord::FrameHeaderSize) != before) {
+                fmt::print("serializePresence/{}: output differs from the reflection writer\n", name);
+            }
+
+            run(fmt::format("serializePresence/{}/reflection", name), iterations, [&] {
+                legacySerialize(before, presence, 1234, 1);
+                doNotOptimize(before);
+            });
+            run(fmt::format("serializePresence/{}/streaming", name), iterations, [&] {
+                discord::serializePresence(buffer, presence, 1234, 1);
+                doNotOptimize(buffer);
+            });
+        }
+
+        std::array<uint8_t, 256> frame{};
+        run("serializeHandshake", iterations, [&] {
+            doNotOptimize(discord::serializeHandshake(frame.data(), frame.size(), 1, "345229890980937739"));
+        });
+
+        std::string buffer;
+        run("serializeSubscribeCommand", iterations, [&] {
+            discord::serializeSubscribeCommand(buffer, 1, "ACTIVITY_JOIN_REQUEST");
+            doNotOptimize(buffer);
+        });
+        run("serializeUnsubscribeCommand", iterations, [&] {
+            discord::serializeUnsubscribeCommand(buffer, 1, "ACTIVITY_JOIN_REQUEST");
+            doNotOptimize(buffer);
+        });
+        run("serializeEmptyPresence", iterations, [&] {
+            discord::serializeEmptyPresence(buffer, 1234, 1);
+            doNotOptimize(buffer);
+        });
+    }
+}
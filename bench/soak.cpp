@@ -0,0 +1,336 @@
+#include "bench.hpp"
+#include "mock-server.hpp"
+
+#include <discord-rpc.hpp>
+#include <fmt/format.h>
+
+#include "platform/platform.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+// End-to-end soak and throughput runs against the mock IPC server.
+// Usage: discord-rpc-soak [--refreshes N] [--commands N] [--reconnects N] [--io-uring] [--json <path|->]
+// Run it with and without --io-uring to compare the io_uring transport with plain socket calls.
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+    using Milliseconds = std::chrono::duration<double, std::milli>;
+
+    struct Summary {
+        explicit Summary(std::string name, std::vector<double> samples = {})
+            : name(std::move(name)), samples(std::move(samples)) {}
+
+        std::string name;
+        std::vector<double> samples; ///< Milliseconds
+        double throughput = 0;       ///< Operations per second, 0 if not measured
+        size_t failures = 0;
+
+        [[nodiscard]] double percentile(double p) const {
+            if (samples.empty()) { return 0; }
+            auto sorted = samples;
+            std::sort(sorted.begin(), sorted.end());
+            auto index = static_cast<size_t>(p / 100.0 * static_cast<double>(sorted.size() - 1));
+            return sorted[index];
+        }
+    };
+
+    std::vector<Summary> g_results;
+    std::string g_suffix; ///< Appended to every result name, tells the transports apart
+
+    void report(Summary summary) {
+        fmt::print(stderr, "{:<40} {:>6} samples  p50 {:>8.3f} ms  p99 {:>8.3f} ms  max {:>8.3f} ms",
+                   summary.name, summary.samples.size(),
+                   summary.percentile(50), summary.percentile(99), summary.percentile(100));
+        if (summary.throughput > 0) {
+            fmt::print(stderr, "  {:>10.0f} ops/s", summary.throughput);
+        }
+        if (summary.failures > 0) {
+            fmt::print(stderr, "  {} failed", summary.failures);
+        }
+        fmt::print(stderr, "\n");
+        summary.name += g_suffix;
+        g_results.push_back(std::move(summary));
+    }
+
+    /// Counts READY or disconnect events, so they can be waited for
+    class EventCounter {
+    public:
+        void notify() {
+            std::lock_guard lock(m_mutex);
+            ++m_count;
+            m_changed.notify_all();
+        }
+
+        size_t count() {
+            std::lock_guard lock(m_mutex);
+            return m_count;
+        }
+
+        bool waitFor(size_t count, std::chrono::seconds timeout) {
+            std::unique_lock lock(m_mutex);
+            return m_changed.wait_for(lock, timeout, [&] { return m_count >= count; });
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_changed;
+        size_t m_count = 0;
+    };
+
+    /// Sends `count` presence updates one after another, each waiting for its acknowledgement
+    Summary refreshLatency(std::string name, size_t count) {
+        auto& rpc = discord::RPCManager::get();
+        Summary summary{std::move(name)};
+        for (size_t i = 0; i < count; ++i) {
+            rpc.getPresence().setState("Soaking").setDetails(fmt::format("Update {}", i));
+            auto start = Clock::now();
+            auto response = bench::wait(rpc.refreshAsync(std::chrono::seconds(10)));
+            if (!response) {
+                ++summary.failures;
+                continue;
+            }
+            summary.samples.push_back(Milliseconds(Clock::now() - start).count());
+        }
+        return summary;
+    }
+
+    /// Pipelines `count` commands with up to `window` in flight
+    Summary commandThroughput(std::string name, size_t count, size_t window) {
+        auto& rpc = discord::RPCManager::get();
+        Summary summary{std::move(name)};
+        std::deque<std::future<discord::CommandResponse>> inFlight;
+
+        auto collect = [&] {
+            auto response = inFlight.front().get();
+            inFlight.pop_front();
+            if (!response) {
+                ++summary.failures;
+                return;
+            }
+            summary.samples.push_back(Milliseconds(response.latency).count());
+        };
+
+        auto start = Clock::now();
+        for (size_t i = 0; i < count; ++i) {
+            if (inFlight.size() >= window) { collect(); }
+            inFlight.push_back(rpc.sendCommand("GET_SELECTED_VOICE_CHANNEL", {}, std::chrono::seconds(10)));
+        }
+        while (!inFlight.empty()) { collect(); }
+
+        auto seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        summary.throughput = static_cast<double>(count) / seconds;
+        return summary;
+    }
+
+    /// Waits until the client failed to reconnect and waits for its next attempt
+    bool waitForBackoff(std::chrono::seconds timeout) {
+        auto& rpc = discord::RPCManager::get();
+        auto deadline = Clock::now() + timeout;
+        while (Clock::now() < deadline) {
+            auto next = rpc.stats().nextReconnect;
+            if (next && *next > Clock::now()) {
+                return true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return false;
+    }
+
+    bool writeJson(char const* path) {
+        auto* file = std::strcmp(path, "-") == 0 ? stdout : std::fopen(path, "w");
+        if (!file) {
+            fmt::print(stderr, "Failed to open {}\n", path);
+            return false;
+        }
+
+        fmt::print(file, "{{\n  \"results\": [");
+        bool first = true;
+        for (auto const& result : g_results) {
+            fmt::print(file,
+                "{}\n    {{\"name\": \"{}\", \"samples\": {}, \"failures\": {}, \"p50_ms\": {:.3f}, "
+                "\"p90_ms\": {:.3f}, \"p99_ms\": {:.3f}, \"max_ms\": {:.3f}, \"ops_per_s\": {:.1f}}}",
+                first ? "" : ",", result.name, result.samples.size(), result.failures,
+                result.percentile(50), result.percentile(90), result.percentile(99), result.percentile(100),
+                result.throughput
+            );
+            first = false;
+        }
+        fmt::print(file, "\n  ]\n}}\n");
+
+        if (file != stdout) {
+            std::fclose(file);
+        }
+        return true;
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t refreshes = 500;
+    size_t commands = 20'000;
+    size_t reconnects = 3;
+    char const* json = nullptr;
+    bool useIOUring = false;
+    for (int i = 1; i < argc; i += 2) {
+        std::string_view option = argv[i];
+        if (option == "--io-uring") {
+            useIOUring = true;
+            --i;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fmt::print(stderr, "Missing value for {}\n", option);
+            return 1;
+        }
+
+        if (option == "--refreshes") {
+            refreshes = std::strtoull(argv[i + 1], nullptr, 10);
+        } else if (option == "--commands") {
+            commands = std::strtoull(argv[i + 1], nullptr, 10);
+        } else if (option == "--reconnects") {
+            reconnects = std::strtoull(argv[i + 1], nullptr, 10);
+        } else if (option == "--json") {
+            json = argv[i + 1];
+        } else {
+            fmt::print(stderr, "Unknown option {}\n", option);
+            return 1;
+        }
+    }
+
+    // the library looks for the pipe in XDG_RUNTIME_DIR, point it at a private directory
+    char directory[] = "/tmp/discord-soak-XXXXXX";
+    if (!::mkdtemp(directory)) {
+        fmt::print(stderr, "Failed to create a runtime directory\n");
+        return 1;
+    }
+    ::setenv("XDG_RUNTIME_DIR", directory, 1);
+
+    #ifdef DISCORD_HAS_IO_URING
+    g_suffix = useIOUring && discord::platform::IOUring::supported() ? "/io_uring" : "/socket";
+    #else
+    g_suffix = "/socket";
+    #endif
+
+    bench::MockServer server(fmt::format("{}/discord-ipc-0", directory));
+    if (!server.start()) {
+        fmt::print(stderr, "Failed to start the mock server in {}\n", directory);
+        return 1;
+    }
+
+    EventCounter ready;
+    EventCounter disconnects;
+    auto& rpc = discord::RPCManager::get();
+    rpc.setClientID("345229890980937739")
+        .setIOUring(useIOUring)
+        .setRateLimit(0, {})
+        .onReady([&](discord::User const&) { ready.notify(); })
+        .onDisconnected([&](int, std::string_view) { disconnects.notify(); });
+
+    auto start = Clock::now();
+    rpc.initialize();
+    if (!ready.waitFor(1, std::chrono::seconds(10))) {
+        fmt::print(stderr, "No READY from the mock server\n");
+        return 1;
+    }
+    report(Summary("time-to-ready", {Milliseconds(Clock::now() - start).count()}));
+
+    report(refreshLatency("refresh-ack", refreshes));
+    report(commandThroughput("command-throughput", commands, 64));
+
+    server.setOptions({.latency = std::chrono::milliseconds(20)});
+    report(refreshLatency("refresh-ack/latency:20ms", std::max<size_t>(refreshes / 10, 1)));
+
+    server.setOptions({.writeChunk = 5});
+    report(refreshLatency("refresh-ack/partial-frames", std::max<size_t>(refreshes / 10, 1)));
+
+    server.setOptions({.readChunk = 256, .readDelay = std::chrono::milliseconds(1)});
+    report(commandThroughput("command-throughput/throttled", std::max<size_t>(commands / 10, 1), 64));
+
+    server.setOptions({.pingInterval = std::chrono::milliseconds(5)});
+    report(refreshLatency("refresh-ack/pings", std::max<size_t>(refreshes / 10, 1)));
+    server.setOptions({});
+
+    // alternate between a vanishing server and a clean CLOSE
+    Summary reconnect{"reconnect"};
+    for (size_t i = 0; i < reconnects; ++i) {
+        auto expected = ready.count() + 1;
+        auto dropped = Clock::now();
+        if (i % 2 == 0) {
+            server.disconnect();
+        } else {
+            server.close(1000, "soak");
+        }
+
+        if (!ready.waitFor(expected, std::chrono::seconds(120))) {
+            ++reconnect.failures;
+            continue;
+        }
+        reconnect.samples.push_back(Milliseconds(Clock::now() - dropped).count());
+    }
+    report(std::move(reconnect));
+
+    // the server vanishes in the middle of a pipelined burst and the client reconnects.
+    // Frames are counted per connection, the current one is past the limit and drops at the next command.
+    // Whether commands are in flight at that moment depends on timing, so the ones lost are only reported.
+    Summary midStream{"reconnect/mid-stream"};
+    Summary midStreamCommands{"command-throughput/mid-stream"}; ///< Commands that made it through
+    Summary midStreamLost{"commands-lost/mid-stream"};         ///< Failures are the commands lost to the drops
+    for (size_t i = 0; i < reconnects; ++i) {
+        auto expected = ready.count() + 1;
+        auto connections = server.connections();
+        auto dropped = Clock::now();
+        server.setOptions({.dropAfterFrames = 16});
+        auto burst = commandThroughput(midStreamCommands.name, 256, 64);
+        server.setOptions({});
+
+        midStreamCommands.samples.insert(midStreamCommands.samples.end(), burst.samples.begin(), burst.samples.end());
+        midStreamLost.failures += burst.failures;
+        if (!ready.waitFor(expected, std::chrono::seconds(120)) || server.connections() <= connections) {
+            ++midStream.failures;
+            continue;
+        }
+        midStream.samples.push_back(Milliseconds(Clock::now() - dropped).count());
+    }
+    report(std::move(midStreamCommands));
+    report(std::move(midStreamLost));
+    report(std::move(midStream));
+
+    // Discord starting while the client waits in the backoff, the socket watcher should connect right away
+    Summary discordStart("discord-start");
+    auto disconnected = disconnects.count() + 1;
+    server.stop();
+    auto expected = ready.count() + 1;
+    if (!disconnects.waitFor(disconnected, std::chrono::seconds(10)) || !waitForBackoff(std::chrono::seconds(120))) {
+        fmt::print(stderr, "The client didn't notice the server stopping\n");
+    }
+    auto started = Clock::now();
+    if (server.start() && ready.waitFor(expected, std::chrono::seconds(120))) {
+        discordStart.samples.push_back(Milliseconds(Clock::now() - started).count());
+    } else {
+        ++discordStart.failures;
+    }
+    report(std::move(discordStart));
+
+    auto stats = rpc.stats();
+    fmt::print(stderr, "library: {} frames sent, {} received, presence ack p50 <= {} us, p99 <= {} us\n",
+               stats.framesSent, stats.framesReceived,
+               stats.presenceAck.percentile(50).count(), stats.presenceAck.percentile(99).count());
+
+    rpc.shutdown();
+    server.stop();
+    ::rmdir(directory);
+
+    if (json && !writeJson(json)) {
+        return 1;
+    }
+    return 0;
+}
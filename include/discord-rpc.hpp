@@ -5,13 +5,25 @@
 #include <array>
 #include <atomic>
 #include <chrono>
+#include <deque>
 #include <functional>
+#include <future>
 #include <memory>
 #include <mutex>
 #include <optional>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "discord-rpc/command-queue.hpp"
+#include "discord-rpc/coroutine.hpp"
+#include "discord-rpc/flight-recorder.hpp"
+#include "discord-rpc/rate-limiter.hpp"
+#include "discord-rpc/reconnect-policy.hpp"
+#include "discord-rpc/stats.hpp"
+#include "discord-rpc/timer-queue.hpp"
+#include "discord-rpc/tracing.hpp"
+#include "discord-rpc/transport.hpp"
 #include "discord-rpc/presence.hpp"
 
 namespace discord {
@@ -29,6 +41,38 @@ namespace discord {
         int premium_type = 0;
     };
 
+    /// An event received from Discord, as delivered by `RPCManager::nextEvent`
+    struct RPCEvent {
+        enum class Type {
+            JoinGame,     ///< `secret` holds the join secret
+            SpectateGame, ///< `secret` holds the spectate secret
+            JoinRequest,  ///< `user` asks to join
+            Shutdown,     ///< The manager was shut down while waiting, no event arrived
+        };
+
+        Type type = Type::JoinGame;
+        std::string secret;
+        User user;
+    };
+
+    /// Outcome of a command sent with `RPCManager::sendCommand`
+    struct CommandResponse {
+        enum class Status {
+            Success, ///< Discord acknowledged the command
+            Error,   ///< Discord answered with an ERROR event, see `code` and `message`
+            Timeout, ///< No response arrived in time
+            Failed,  ///< The command couldn't be sent (queue full or connection lost)
+        };
+
+        Status status = Status::Failed;
+        int code = 0;
+        std::string message;
+        std::string data; ///< Raw JSON of the response's `data` field
+        std::chrono::steady_clock::duration latency{}; ///< Time from sendCommand() until the response arrived
+
+        explicit operator bool() const noexcept { return status == Status::Success; }
+    };
+
     class RPCManager {
     private:
         // prevent construction from outside
@@ -36,6 +80,7 @@ namespace discord {
         ~RPCManager() noexcept { shutdown(); }
 
         friend class Connection;
+        friend struct IOWorker;
 
     public:
         static RPCManager& get() noexcept {
@@ -60,6 +105,8 @@ namespace discord {
         RPCManager& update() noexcept;
 
         /// Send a new presence to the Discord client
+        /// @note Presence identical to the last one sent is skipped, unless the connection was re-established since.
+        /// Safe to call from multiple threads, as long as the presence isn't modified at the same time.
         RPCManager& refresh() noexcept;
 
         /// Get current rich presence information. You can use this to access the builder directly.
@@ -68,6 +115,122 @@ namespace discord {
         /// Clear the current rich presence information. Calls refresh() automatically.
         RPCManager& clearPresence() noexcept;
 
+        /// Collapse queued presence updates so only the newest one (or a clear) is sent.
+        /// @param enabled Whether presence updates should be coalesced (enabled by default)
+        /// @param debounce Optional window that merges bursts of updates into a single command
+        RPCManager& setPresenceCoalescing(bool enabled, std::chrono::milliseconds debounce = {}) noexcept {
+            m_commandQueue.setCoalescing(enabled, debounce);
+            return *this;
+        }
+
+        /// Skip refresh() calls whose presence is identical to the last one queued.
+        /// @param enabled Whether unchanged presence is dropped before it's queued (enabled by default)
+        RPCManager& setPresenceDeduplication(bool enabled) noexcept {
+            m_deduplicatePresence.store(enabled);
+            return *this;
+        }
+
+        /// Bound the number of commands waiting to be sent, so memory stays flat while Discord is unreachable.
+        /// Only the newest presence survives a disconnected period and is replayed on reconnect, whatever the policy.
+        /// @param capacity Maximum number of queued commands
+        /// @param policy What to drop once full. With KeepLatestPresence (default), a new presence replaces the oldest
+        /// queued one and other new commands are dropped.
+        RPCManager& setQueueLimits(size_t capacity, QueuePolicy policy = QueuePolicy::KeepLatestPresence) noexcept {
+            m_commandQueue.setLimits(capacity, policy);
+            return *this;
+        }
+
+        /// Sends an arbitrary RPC command, its response is matched back by nonce.
+        /// Any number of commands can be in flight at once, they are sent in order with everything else.
+        /// @param command Command name, e.g. "GET_CHANNELS"
+        /// @param args JSON object with the arguments, empty for none
+        /// @param callback Called once with the response, on the IO worker thread (or from update())
+        /// @param timeout Time after which the command fails with `Status::Timeout`
+        RPCManager& sendCommand(
+            std::string_view command, std::string_view args,
+            std::function<void(CommandResponse const&)> callback,
+            std::chrono::milliseconds timeout = std::chrono::seconds(5)
+        ) noexcept;
+
+        /// Same as above, the response is delivered through a future
+        std::future<CommandResponse> sendCommand(
+            std::string_view command, std::string_view args = {},
+            std::chrono::milliseconds timeout = std::chrono::seconds(5)
+        );
+
+        /// Sets how coroutines awaiting the manager are resumed, by default they resume right on the IO worker
+        RPCManager& setScheduler(Scheduler scheduler) noexcept {
+            m_scheduler = std::move(scheduler);
+            return *this;
+        }
+
+        /// Resumes once the connection to Discord is ready (right away if it already is)
+        /// @return The connected user, or a user with an empty id if the manager was shut down first
+        Awaitable<User> connected();
+
+        /// Sends the current presence like refresh(), resuming once Discord acknowledged it.
+        /// A presence that was coalesced into a newer one completes with the newer one's response,
+        /// an unchanged presence completes right away.
+        Awaitable<CommandResponse> refreshAsync(std::chrono::milliseconds timeout = std::chrono::seconds(30));
+
+        /// Same as sendCommand, resuming with the response
+        Awaitable<CommandResponse> sendCommandAsync(
+            std::string_view command, std::string_view args = {},
+            std::chrono::milliseconds timeout = std::chrono::seconds(5)
+        );
+
+        /// Resumes with the next join/spectate/join request event.
+        /// The first call subscribes to all of them, events arriving while nobody waits are buffered.
+        /// Resumes with a `Shutdown` event if the manager is shut down first.
+        Awaitable<RPCEvent> nextEvent();
+
+        /// Limit how often SET_ACTIVITY is sent, Discord throttles updates to roughly 5 per 20 seconds.
+        /// Excess updates are held back and the newest presence is sent as soon as the budget allows it.
+        /// Other commands aren't limited and don't wait behind a held back presence.
+        /// @param budget Number of updates allowed per period, 0 disables the limit
+        /// @param period Time in which the whole budget refills
+        RPCManager& setRateLimit(uint32_t budget, std::chrono::milliseconds period) noexcept;
+
+        /// Snapshot of the traffic, queue, connection and latency counters, can be called from any thread without locking
+        Stats stats() const noexcept;
+
+        /// Recent protocol events (frames, state changes, errors), oldest first. Always recorded, safe from any thread.
+        std::vector<ProtocolEvent> recentProtocolEvents() const;
+
+        /// Human readable dump of `recentProtocolEvents()`, one event per line
+        std::string dumpProtocolEvents() const;
+
+        /// Sends the library's trace zones to a backend, e.g. a `ChromeTraceWriter` from `<discord-rpc/chrome-trace-writer.hpp>`, null to stop tracing.
+        /// The backend must outlive its use, zones are only emitted in builds with `DISCORD_ENABLE_TRACING`.
+        RPCManager& setTraceBackend(TraceBackend* backend) noexcept;
+
+        /// Runs a callback on the IO worker (or in update()) once `deadline` has passed, e.g. to change the presence later.
+        /// The worker sleeps until exactly the earliest scheduled deadline, there's no polling.
+        /// @return Handle for cancelScheduled()
+        TimerQueue::TimerID schedule(std::chrono::steady_clock::time_point deadline, std::function<void()> callback);
+
+        /// @return false if the callback already ran or was cancelled
+        bool cancelScheduled(TimerQueue::TimerID id) noexcept { return m_timers.cancel(id); }
+
+        /// How long to wait between connection attempts while Discord is unreachable.
+        /// Delays start over once a connection stayed up for `HealthyConnectionTime` after READY,
+        /// the first attempt after such a connection drops is immediate.
+        RPCManager& setReconnectPolicy(ReconnectOptions const& options) noexcept;
+
+        /// Linux only: drive the pipe through io_uring instead of plain socket calls, off by default.
+        /// Takes effect at the next connect. Ignored if the kernel lacks support or `DISCORD_RPC_DISABLE_IO_URING` is set.
+        RPCManager& setIOUring(bool enabled) noexcept;
+
+        /// Runs the protocol over another transport, e.g. a `LoopbackTransport` in tests, null for the platform's pipe.
+        /// Takes effect at the next connect, the transport must outlive its use.
+        RPCManager& setTransport(Transport* transport) noexcept;
+
+        /// Number of times a presence update had to wait for the rate limit
+        uint64_t deferredUpdates() const noexcept { return m_deferredUpdates.load(std::memory_order_relaxed); }
+
+        /// Number of presence updates that were never sent, because a newer one replaced them or the queue was full
+        uint64_t droppedUpdates() const noexcept;
+
         #define GENERATE_SETTER_LRVALUE(type, name, member) \
         RPCManager& name(type const& member) noexcept { m_##member = member; return *this; } \
         RPCManager& name(type&& member) noexcept { m_##member = std::move(member); return *this; }
@@ -77,13 +240,57 @@ namespace discord {
         GENERATE_SETTER_LRVALUE(std::function<void(User const&)>, onReady, onReady)
         GENERATE_SETTER_LRVALUE(std::function<void(int, std::string_view)>, onDisconnected, onDisconnected)
         GENERATE_SETTER_LRVALUE(std::function<void(int, std::string_view)>, onErrored, onErrored)
-        GENERATE_SETTER_LRVALUE(std::function<void(std::string_view)>, onJoinGame, onJoinGame)
-        GENERATE_SETTER_LRVALUE(std::function<void(std::string_view)>, onSpectateGame, onSpectateGame)
-        GENERATE_SETTER_LRVALUE(std::function<void(User const&)>, onJoinRequest, onJoinRequest)
+        /// Called with `dumpProtocolEvents()` whenever the connection is lost, meant for logs and bug reports
+        GENERATE_SETTER_LRVALUE(std::function<void(std::string_view)>, onDiagnostics, onDiagnostics)
+
+        // setting an event callback subscribes to the event, resetting it unsubscribes
+        #define GENERATE_EVENT_SETTER_LRVALUE(type, name, member, event) \
+        RPCManager& name(type const& member) noexcept { m_##member = member; return setSubscribed(event, bool(m_##member)); } \
+        RPCManager& name(type&& member) noexcept { m_##member = std::move(member); return setSubscribed(event, bool(m_##member)); }
 
+        GENERATE_EVENT_SETTER_LRVALUE(std::function<void(std::string_view)>, onJoinGame, onJoinGame, Event::ActivityJoin)
+        GENERATE_EVENT_SETTER_LRVALUE(std::function<void(std::string_view)>, onSpectateGame, onSpectateGame, Event::ActivitySpectate)
+        GENERATE_EVENT_SETTER_LRVALUE(std::function<void(User const&)>, onJoinRequest, onJoinRequest, Event::ActivityJoinRequest)
+
+        #undef GENERATE_EVENT_SETTER_LRVALUE
         #undef GENERATE_SETTER_LRVALUE
 
     private:
+        /// Events that are only subscribed to while a callback is set
+        struct Event {
+            static constexpr uint8_t ActivityJoin        = 1 << 0;
+            static constexpr uint8_t ActivitySpectate    = 1 << 1;
+            static constexpr uint8_t ActivityJoinRequest = 1 << 2;
+        };
+
+        static constexpr uint8_t AllEvents = Event::ActivityJoin | Event::ActivitySpectate | Event::ActivityJoinRequest;
+
+        /// Events buffered for nextEvent() while no coroutine waits for them
+        static constexpr size_t MaxBufferedEvents = 32;
+
+        /// Time Discord has to answer the handshake before the connection is dropped and retried
+        static constexpr auto HandshakeTimeout = std::chrono::seconds(10);
+
+        /// A connection that stays up this long after READY is healthy, the reconnect delays start over.
+        /// One that's dropped sooner keeps backing off, so a peer that accepts and hangs up isn't hammered.
+        static constexpr auto HealthyConnectionTime = std::chrono::seconds(10);
+
+        /// Discord's socket appears at bind(), a connect before its listen() is refused.
+        /// Attempts after the socket appeared are retried this often and this quickly before the backoff applies again.
+        static constexpr uint32_t SocketRetries = 5;
+        static constexpr auto SocketRetryDelay = std::chrono::milliseconds(100);
+
+        /// SET_ACTIVITY writes remembered for measuring their acknowledgement
+        static constexpr size_t MaxTrackedPresences = 16;
+
+        /// Command sent with sendCommand() that is waiting for its response
+        struct PendingCommand {
+            std::function<void(CommandResponse const&)> callback;
+            CommandQueue::Clock::time_point sentAt;
+            CommandQueue::Clock::time_point deadline;
+            bool presence = false; ///< SET_ACTIVITY, completed by the response of any newer one
+        };
+
         void invokeOnReady(User const& user) const noexcept {
             if (m_onReady) { m_onReady(user); }
         }
@@ -96,6 +303,9 @@ namespace discord {
             if (m_onErrored) { m_onErrored(errcode, message); }
         }
 
+        /// Hands the flight recorder's contents to the diagnostics callback, if there is one
+        void reportDiagnostics() const noexcept;
+
         void invokeOnJoinGame(std::string_view joinSecret) const noexcept {
             if (m_onJoinGame) { m_onJoinGame(joinSecret); }
         }
@@ -110,6 +320,71 @@ namespace discord {
 
         void updateReconnectTime() noexcept;
 
+        /// Stops the handshake timeout, the handshake finished or the connection is gone
+        void cancelHandshakeTimer() noexcept;
+
+        /// Makes the next update() connect without waiting for the reconnect delay, e.g. because Discord's socket appeared
+        void connectNow() noexcept;
+
+        /// Returns when the IO worker has to wake up even if nothing happens on the pipe
+        std::optional<CommandQueue::Clock::time_point> nextDeadline() const noexcept;
+
+        /// Makes the next refresh() send the presence even if it didn't change (e.g. after a reconnect)
+        void invalidatePresenceFingerprint() noexcept { m_resendPresence.store(true); }
+
+        /// Returns true if the activity differs from the last one queued, and remembers it.
+        /// The fingerprint is invalidated when a presence may not have reached Discord (an error or a disconnect).
+        bool updatePresenceFingerprint(std::string_view activity) noexcept;
+
+        /// Marks an event as wanted or not and wakes up the IO worker to (un)subscribe
+        RPCManager& setSubscribed(uint8_t event, bool subscribed) noexcept;
+
+        /// Forgets what the previous connection was subscribed to, a new connection starts with nothing
+        void invalidateSubscriptions() noexcept { m_subscribedEvents = 0; }
+
+        /// Queues SUBSCRIBE/UNSUBSCRIBE commands for events whose callbacks changed
+        void syncSubscriptions() noexcept;
+
+        /// Routes a DISPATCH frame to the callback of its event, and responses to their pending command
+        void dispatchEvent(std::string_view payload) noexcept;
+
+        /// Adds a command to the in-flight table, before it's queued so the response can't arrive first
+        void registerCommand(
+            int nonce, std::function<void(CommandResponse const&)> callback,
+            std::chrono::milliseconds timeout, bool presence = false
+        ) noexcept;
+
+        /// Removes the pending command with the given nonce from the in-flight table
+        std::optional<PendingCommand> takeCommand(int nonce) noexcept;
+
+        /// Completes presence commands older than an acknowledged one, they were coalesced into it
+        void completeSupersededPresences(int nonce, CommandResponse const& response) noexcept;
+
+        /// Fails commands whose timeout passed
+        void expireCommands(CommandQueue::Clock::time_point now) noexcept;
+
+        /// Fails every pending command, their responses can't arrive anymore
+        void failCommands(std::string_view reason) noexcept;
+
+        /// Fails commands the queue dropped instead of letting them time out
+        void failDroppedCommands() noexcept;
+
+        /// Publishes a serialized SET_ACTIVITY command and wakes up the IO worker
+        /// @return false if the queue was full
+        bool submitPresence(std::string& buffer) noexcept;
+
+        /// Called by the connection once READY arrives
+        void handleReady(User const& user) noexcept;
+
+        /// Called by the connection when it's closed
+        void handleClosed(std::string_view reason) noexcept;
+
+        /// Hands an event to a waiting nextEvent(), or buffers it
+        void publishEvent(RPCEvent event) noexcept;
+
+        /// Resumes every coroutine still waiting in connected() or nextEvent(), their frames would leak otherwise
+        void cancelWaiters() noexcept;
+
     private:
         // User settings
         std::string m_clientID;
@@ -117,6 +392,7 @@ namespace discord {
         std::function<void(User const&)> m_onReady;
         std::function<void(int, std::string_view)> m_onDisconnected;
         std::function<void(int, std::string_view)> m_onErrored;
+        std::function<void(std::string_view)> m_onDiagnostics;
         std::function<void(std::string_view)> m_onJoinGame;
         std::function<void(std::string_view)> m_onSpectateGame;
         std::function<void(User const&)> m_onJoinRequest;
@@ -126,10 +402,52 @@ namespace discord {
 
         // Internal
         IOWorker* m_ioWorker = nullptr;
-        std::chrono::time_point<std::chrono::system_clock> m_nextConnect = std::chrono::system_clock::now();
+        ReconnectPolicy m_reconnectPolicy{};
+        TokenBucket m_rateLimiter{};
+        TimerQueue m_timers{};
+        TimerQueue::TimerID m_handshakeTimer = 0; ///< Only touched by the IO worker
+        TimerQueue::TimerID m_healthyTimer = 0;   ///< Resets the reconnect policy, only touched by the IO worker
+        uint32_t m_socketRetries = 0; ///< Quick retries left since Discord's socket appeared, IO worker only
+        CommandQueue::Clock::time_point m_backoffStart = CommandQueue::Clock::now(); ///< For the reconnectBackoff trace zone
         size_t m_processID = 0;
-        int m_nonce = 1;
+        std::atomic_int m_nonce = 1;
         CommandQueue m_commandQueue{};
+
+        // Last sent activity, used to skip identical updates
+        std::atomic<uint64_t> m_lastActivityHash = 0;
+        std::atomic<size_t> m_lastActivityLength = std::string::npos;
+        std::atomic_bool m_resendPresence = true;
+        std::atomic_bool m_deduplicatePresence = true;
+
+        // Event subscriptions
+        std::atomic<uint8_t> m_wantedEvents = 0;
+        uint8_t m_subscribedEvents = 0;
+
+        // Commands waiting for a response, keyed by nonce
+        mutable std::mutex m_pendingMutex;
+        std::unordered_map<int, PendingCommand> m_pendingCommands;
+        CommandQueue::Clock::time_point m_nextTimeout = CommandQueue::Clock::time_point::max();
+
+        size_t m_pendingPresences = 0;
+
+        // Coroutine support
+        Scheduler m_scheduler;
+        std::mutex m_awaitMutex;
+        std::optional<User> m_connectedUser;
+        std::vector<std::function<void(User)>> m_connectWaiters;
+        std::deque<RPCEvent> m_bufferedEvents;
+        std::deque<std::function<void(RPCEvent)>> m_eventWaiters;
+        std::atomic_bool m_eventsAwaited = false;
+
+        // When SET_ACTIVITY commands were written, responses arrive in the same order
+        std::deque<CommandQueue::Clock::time_point> m_presenceWrites;
+        /// Last SET_ACTIVITY written, replayed after READY since Discord drops the presence of a client that disconnects.
+        /// Only touched by the IO worker.
+        std::string m_lastActivity;
+
+        // Rate limiting
+        bool m_activityDeferred = false;
+        std::atomic<uint64_t> m_deferredUpdates = 0;
     };
 }
 
@@ -0,0 +1,54 @@
+#pragma once
+#ifndef DISCORD_RPC_CHROME_TRACE_WRITER_HPP
+#define DISCORD_RPC_CHROME_TRACE_WRITER_HPP
+
+#include "tracing.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace discord {
+    /// @brief Built-in backend recording Chrome trace-event JSON, which chrome://tracing and Perfetto can open.
+    /// Opt-in header, zones only reach it when the library is built with `DISCORD_ENABLE_TRACING`.
+    class ChromeTraceWriter final : public TraceBackend {
+    public:
+        /// @param maxEvents Events recorded at most, later ones are dropped
+        explicit ChromeTraceWriter(size_t maxEvents = 1 << 20) noexcept;
+
+        void beginZone(char const* name) noexcept override;
+        void endZone(char const* name) noexcept override;
+        void completeZone(char const* name, Clock::time_point start, Clock::time_point end) noexcept override;
+
+        /// Writes everything recorded so far as a trace-event JSON document
+        void write(std::ostream& out) const;
+
+        /// Writes the trace to a file
+        /// @return false if the file couldn't be written
+        bool save(std::string const& path) const;
+
+        /// Drops everything recorded so far
+        void clear() noexcept;
+
+    private:
+        struct Event {
+            char const* name;
+            char phase;     ///< 'B'egin, 'E'nd or 'X' (complete)
+            uint32_t thread;
+            int64_t start;  ///< Microseconds since the writer was created
+            int64_t duration;
+        };
+
+        void record(char const* name, char phase, Clock::time_point start, Clock::duration duration = {}) noexcept;
+
+        Clock::time_point m_epoch = Clock::now();
+        size_t m_maxEvents;
+        mutable std::mutex m_mutex;
+        std::vector<Event> m_events;
+    };
+}
+
+#endif // DISCORD_RPC_CHROME_TRACE_WRITER_HPP
@@ -2,41 +2,211 @@
 #ifndef DISCORD_RPC_COMMAND_QUEUE_HPP
 #define DISCORD_RPC_COMMAND_QUEUE_HPP
 
-#include <queue>
-#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <string>
 #include <optional>
+#include <span>
+#include <utility>
+#include <vector>
 
 namespace discord {
-    /// @brief A simple command queue for Discord RPC commands
+    /// @brief Kind of a queued command, used to decide whether it can be coalesced
+    enum class CommandType {
+        Generic,  ///< Sent in order, never merged with other commands
+        Activity, ///< SET_ACTIVITY, only the newest one matters
+    };
+
+    /// @brief What the queue does with commands it can't hold
+    enum class QueuePolicy {
+        KeepLatestPresence, ///< Once full, new commands are dropped, except a presence, which replaces the oldest queued one
+        DropOldest,         ///< Once full, the oldest command queued before the current collect() is dropped for a new one
+        Reject,             ///< Once full, new commands are dropped (a coalesced presence still replaces the held one)
+    };
+
+    /// @brief A lock-free multi-producer/single-consumer queue for Discord RPC commands.
+    ///
+    /// Producers serialize into their own buffer and publish it into a ring of preallocated
+    /// slots, swapping buffers instead of copying them. The consumer (the IO worker) moves
+    /// published commands out of the ring, coalescing activity commands on the way.
+    /// While coalescing, an activity that finds the ring full replaces the one in a single
+    /// overflow slot instead of being dropped, so the newest presence is never lost.
+    /// Activities are ordered by when their submit() started, not by ring position.
     class CommandQueue {
     public:
-        CommandQueue() noexcept = default;
-        ~CommandQueue() noexcept = default;
+        using Clock = std::chrono::steady_clock;
+
+        static constexpr size_t DefaultCapacity = 64;
+
+        /// @brief A command taken out of the ring, waiting to be sent
+        struct Entry {
+            std::string command;
+            CommandType type = CommandType::Generic;
+            int nonce = 0;                ///< Reported by takeDropped() if the command is dropped
+            Clock::time_point queuedAt{}; ///< When the command was published
+        };
+
+        /// @param capacity Number of ring slots, rounded up to a power of two
+        explicit CommandQueue(size_t capacity = DefaultCapacity) noexcept;
+        ~CommandQueue() noexcept;
+
+        CommandQueue(CommandQueue const&) = delete;
+        CommandQueue& operator=(CommandQueue const&) = delete;
+
+        // Producer side, safe to call from any thread
 
         /// @brief Adds a command to the queue
-        void push(std::string const& command) noexcept;
-        void push(std::string&& command) noexcept;
+        /// @param nonce Identifies a command someone waits a response for, 0 if nobody does
+        /// @return false if the ring is full
+        bool push(std::string const& command, CommandType type = CommandType::Generic, int nonce = 0) noexcept;
+        bool push(std::string&& command, CommandType type = CommandType::Generic, int nonce = 0) noexcept;
+
+        /// @brief Moves a command into the queue and leaves a recycled buffer in its place,
+        /// so the caller can serialize the next command without allocating.
+        /// A coalesced activity that finds the ring full goes to the overflow slot instead.
+        /// @return false if the ring is full, `command` is left untouched in that case
+        bool submit(std::string& command, CommandType type = CommandType::Generic, int nonce = 0) noexcept;
+
+        /// @brief Enables or disables latest-wins coalescing of activity commands.
+        /// @param enabled Whether activity commands should replace each other while queued
+        /// @param debounce How long a coalesced activity is held back after the last update,
+        /// so bursts of setter calls are merged into one command
+        void setCoalescing(bool enabled, std::chrono::milliseconds debounce = {}) noexcept;
+
+        /// @brief Limits how many commands are held on the consumer side and what happens past that.
+        /// @param capacity Maximum number of commands waiting to be sent, including the coalesced presence
+        /// @param policy What to drop once the capacity is reached, and while disconnected
+        void setLimits(size_t capacity, QueuePolicy policy) noexcept;
+
+        /// @brief Returns how many commands were dropped because of the limits
+        size_t dropped() const noexcept { return m_dropped.load(std::memory_order_relaxed); }
+
+        /// @brief Returns how many activities were replaced by a newer one before being sent
+        size_t superseded() const noexcept { return m_superseded.load(std::memory_order_relaxed); }
+
+        // Consumer side, only the thread draining the queue may call these
+
+        /// @brief Moves all published commands out of the ring, coalescing activities.
+        void collect() noexcept;
+
+        /// @brief Collects commands while the pipe is closed. Superseded activities are dropped,
+        /// so only the current presence is replayed on reconnect, other commands are kept.
+        void prune() noexcept;
 
-        /// @brief Pushes a new command to the queue and returns a reference to the prepared command.
-        /// Mutex remains locked after this call, so make sure to call `finish()` after filling the command.
-        std::string& prepare() noexcept;
+        /// @brief Returns every command that is ready to be sent, oldest first.
+        /// The commands stay queued until `consume()` is called, so whatever couldn't be
+        /// sent stays at the front, ahead of commands queued later.
+        /// A ready coalesced activity is only lent to the batch: unless `consume()` confirms it was sent,
+        /// it goes back to the coalescing slot, where a newer activity can still replace it.
+        /// @param includeActivity Whether a ready coalesced activity may join the batch (e.g. rate limit permitting)
+        /// @note The span is valid until the next call to any consumer side method.
+        std::span<Entry> drain(bool includeActivity = true) noexcept;
 
-        /// @brief Unlocks the mutex after a `prepare()` call.
-        void finish() noexcept;
+        /// @brief Moves activities past `budget` behind every other command of the batch returned by `drain()`,
+        /// keeping their order, so commands that don't need a rate limit token don't wait behind them.
+        /// @return Number of leading commands that may be sent
+        size_t deferActivities(size_t budget) noexcept;
 
-        /// @brief Pops a command from the queue
-        std::optional<std::string> pop() noexcept;
+        /// @brief Removes the first `count` commands returned by `drain()`, after they were sent.
+        void consume(size_t count) noexcept;
+
+        /// @brief Returns the nonces of commands dropped since the last call, so their callers can be failed
+        std::vector<int> takeDropped() noexcept { return std::exchange(m_droppedNonces, {}); }
+
+        /// @brief Pops a command from the queue by swapping it into `command`.
+        /// The previous contents of `command` are kept as a spare buffer, so steady-state
+        /// use of the queue doesn't allocate.
+        /// @note A coalesced activity is only returned once its debounce window has passed.
+        /// @return true if a command was popped
+        bool pop(std::string& command) noexcept;
 
         /// @brief Checks if the queue is empty
         bool empty() const noexcept;
 
-        /// @brief Returns the size of the queue
+        /// @brief Returns the number of queued commands, including published ones that weren't collected yet
+        /// @note Consumer side only, like empty(), it reads state that collect() changes without synchronization
         size_t size() const noexcept;
 
+        /// @brief Whether a collected activity is waiting to be sent
+        bool holdsActivity() const noexcept;
+
+        /// @brief Returns the time at which a held back activity becomes ready, if there is one
+        std::optional<Clock::time_point> pendingDeadline() const noexcept;
+
     private:
-        std::queue<std::string> m_queue; ///< The internal command queue
-        mutable std::mutex m_mutex;      ///< Mutex for thread safety
+        struct Slot {
+            std::atomic<size_t> sequence;  ///< Ring position the slot is ready for
+            CommandType type = CommandType::Generic;
+            uint64_t order = 0;            ///< Activities only, see `m_activityOrder`
+            Clock::time_point queuedAt{};
+            int nonce = 0;
+            std::string command;
+        };
+
+        /// @brief A coalesced activity that found the ring full
+        struct Overflow {
+            std::string command;
+            uint64_t order;
+            Clock::time_point queuedAt;
+        };
+
+        /// @brief Puts an activity into the overflow slot, unless a newer one is there
+        /// @return false if coalescing is off
+        bool overflow(std::string& command, uint64_t order) noexcept;
+
+        /// @brief Coalesces the activity from the overflow slot
+        void collectOverflow(bool coalesce, std::chrono::milliseconds debounce) noexcept;
+
+        /// @brief Whether a collected activity is newer than every one before it, counts the one that loses
+        bool supersedes(uint64_t order) noexcept;
+
+        /// @brief Returns a recycled buffer for a new command
+        std::string takeSpare() noexcept;
+
+        /// @brief Keeps the buffer around for later commands
+        void recycle(std::string&& buffer) noexcept;
+
+        /// @brief Takes the activity lent to the batch by drain() back into the coalescing slot
+        void reclaimActivity() noexcept;
+
+        /// @brief Adds a collected command to the batch, enforcing the capacity
+        void append(std::string&& command, CommandType type, Clock::time_point queuedAt, int nonce = 0) noexcept;
+
+        /// @brief Drops a collected command
+        void discard(std::string&& command, int nonce = 0) noexcept;
+
+        static constexpr size_t MaxSpareBuffers = 8;
+        static constexpr size_t CacheLineSize = 64;
+
+        // Ring
+        std::unique_ptr<Slot[]> m_slots; ///< Preallocated ring slots
+        size_t m_mask = 0;               ///< Capacity - 1
+        alignas(CacheLineSize) std::atomic<size_t> m_tail = 0; ///< Next position claimed by producers
+        alignas(CacheLineSize) size_t m_head = 0;              ///< Next position read by the consumer
+        alignas(CacheLineSize) std::atomic<Overflow*> m_overflow = nullptr; ///< Newest activity that found the ring full
+        std::atomic<uint64_t> m_activityOrder = 1; ///< Next order handed to a submitted activity
+
+        // Settings
+        std::atomic_bool m_coalesce = true;          ///< Whether activity commands are coalesced
+        std::atomic<int64_t> m_debounceMs = 0;       ///< Debounce window for coalesced activities
+        std::atomic<size_t> m_limit = DefaultCapacity;                         ///< Maximum commands held
+        std::atomic<QueuePolicy> m_policy = QueuePolicy::KeepLatestPresence;   ///< What to drop
+        std::atomic<size_t> m_dropped = 0;                                     ///< Commands dropped so far
+        std::atomic<size_t> m_superseded = 0;                                  ///< Activities coalesced away
+
+        // Consumer state
+        std::vector<Entry> m_batch;            ///< Commands taken out of the ring, in order
+        std::vector<std::string> m_spare;      ///< Buffers of popped commands, handed back to producers
+        std::vector<int> m_droppedNonces;      ///< Dropped commands someone waits for, see takeDropped()
+        size_t m_evictable = 0;                ///< Leading batch entries queued before the current collect(), see append()
+        bool m_hasActivity = false;            ///< Whether `m_activity` holds an unsent command
+        bool m_activityLent = false;           ///< Whether the activity is the last batch entry, see drain()
+        bool m_activityStalled = false;        ///< Whether the ready activity couldn't be sent, until the next drain()
+        Clock::time_point m_activityReadyAt{}; ///< When the coalesced activity may be sent
+        Clock::time_point m_activityQueuedAt{}; ///< When the coalesced activity was published
+        uint64_t m_newestActivity = 0;         ///< Order of the newest activity collected, older ones are stale
+        std::string m_activity;                ///< Latest coalesced activity command
     };
 }
 
@@ -0,0 +1,73 @@
+#pragma once
+#ifndef DISCORD_RPC_COROUTINE_HPP
+#define DISCORD_RPC_COROUTINE_HPP
+
+#include <atomic>
+#include <coroutine>
+#include <functional>
+#include <optional>
+#include <utility>
+
+namespace discord {
+    /// @brief Resumes a coroutine waiting on the RPC manager, e.g. by posting it to an engine's task system.
+    /// Called on the IO worker thread (or the thread calling update()). A coroutine whose result is
+    /// already known when it suspends isn't suspended at all, and the scheduler isn't called.
+    using Scheduler = std::function<void(std::coroutine_handle<>)>;
+
+    /// @brief Awaiter for an operation completing with a `T`, started when the coroutine suspends.
+    ///
+    /// The operation receives a completion function, which stores the result and hands the
+    /// coroutine to the scheduler. The awaiter must stay alive until then, which `co_await`
+    /// on a temporary guarantees. A completion that runs before the operation returns
+    /// cancels the suspension instead of resuming the coroutine from inside `await_suspend`.
+    template <typename T>
+    class Awaitable {
+    public:
+        using Complete = std::function<void(T)>;
+        using Start = std::function<void(Complete)>;
+
+        Awaitable(Start start, Scheduler scheduler) noexcept
+            : m_start(std::move(start)), m_scheduler(std::move(scheduler)) {}
+
+        /// Only valid before it's awaited
+        Awaitable(Awaitable&& other) noexcept
+            : m_start(std::move(other.m_start)), m_scheduler(std::move(other.m_scheduler)) {}
+
+        bool await_ready() const noexcept { return false; }
+
+        /// @return false if the result arrived while starting the operation, the coroutine continues right away
+        bool await_suspend(std::coroutine_handle<> handle) {
+            m_start(
+                [this, handle](T value) {
+                    m_value.emplace(std::move(value));
+                    // whoever comes second resumes: here if await_suspend already returned
+                    if (m_state.exchange(State::Completed, std::memory_order_acq_rel) != State::Suspended) {
+                        return;
+                    }
+
+                    // the awaiter goes away once the coroutine resumes, the scheduler might do that right away
+                    if (auto scheduler = std::move(m_scheduler)) {
+                        scheduler(handle);
+                    } else {
+                        handle.resume();
+                    }
+                }
+            );
+
+            auto expected = State::Starting;
+            return m_state.compare_exchange_strong(expected, State::Suspended, std::memory_order_acq_rel);
+        }
+
+        T await_resume() { return std::move(*m_value); }
+
+    private:
+        Start m_start;
+        Scheduler m_scheduler;
+        std::optional<T> m_value;
+
+        enum class State { Starting, Suspended, Completed };
+        std::atomic<State> m_state = State::Starting;
+    };
+}
+
+#endif // DISCORD_RPC_COROUTINE_HPP
@@ -0,0 +1,28 @@
+#pragma once
+#ifndef DISCORD_RPC_FLIGHT_RECORDER_HPP
+#define DISCORD_RPC_FLIGHT_RECORDER_HPP
+
+#include <chrono>
+#include <cstdint>
+
+namespace discord {
+    /// @brief One entry of the protocol flight recorder, see `RPCManager::recentProtocolEvents()`
+    struct ProtocolEvent {
+        enum class Kind : uint8_t {
+            Sent,     ///< A frame (or the rest of one) was written
+            Received, ///< A frame was read
+            State,    ///< The connection changed state
+            Error,    ///< Something failed, see `error`
+        };
+
+        std::chrono::steady_clock::time_point time{};
+        Kind kind = Kind::Sent;
+        uint8_t opcode = 0; ///< IPC opcode of the frame (Sent/Received)
+        uint8_t state = 0;  ///< Connection state after the event (0 disconnected ... 3 connected)
+        uint32_t size = 0;  ///< Bytes written or payload length received
+        int32_t nonce = 0;  ///< Command nonce, 0 if the frame has none
+        int32_t error = 0;  ///< errno / platform error code, or the library's error code for Error events
+    };
+}
+
+#endif // DISCORD_RPC_FLIGHT_RECORDER_HPP
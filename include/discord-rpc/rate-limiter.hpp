@@ -0,0 +1,81 @@
+#pragma once
+#ifndef DISCORD_RPC_RATE_LIMITER_HPP
+#define DISCORD_RPC_RATE_LIMITER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <optional>
+
+namespace discord {
+    /// Token bucket matching Discord's SET_ACTIVITY budget (roughly 5 updates per 20 seconds).
+    /// Each RPCManager owns one. Settings can be changed from any thread, the bucket itself is only used by the IO worker.
+    class TokenBucket {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        static constexpr uint32_t Unlimited = std::numeric_limits<uint32_t>::max();
+
+        /// @param budget Number of updates allowed per period, 0 disables the limit
+        /// @param period Time in which the whole budget refills
+        void configure(uint32_t budget, std::chrono::milliseconds period) noexcept {
+            m_budget.store(budget, std::memory_order_relaxed);
+            m_periodMs.store(std::max<int64_t>(period.count(), 1), std::memory_order_relaxed);
+        }
+
+        /// Refills the bucket and returns how many tokens are available
+        uint32_t available(Clock::time_point now) noexcept {
+            auto budget = m_budget.load(std::memory_order_relaxed);
+            if (budget == 0) {
+                return Unlimited;
+            }
+
+            if (m_tokens > budget) {
+                m_tokens = budget;
+            }
+
+            auto interval = refillInterval(budget);
+            if (m_tokens < budget && now > m_lastRefill) {
+                auto refilled = static_cast<uint32_t>(std::min<int64_t>((now - m_lastRefill) / interval, budget));
+                m_tokens = std::min(budget, m_tokens + refilled);
+                m_lastRefill += interval * refilled;
+            }
+
+            if (m_tokens == budget) {
+                m_lastRefill = now;
+            }
+
+            return m_tokens;
+        }
+
+        /// Uses up a token, call after `available()` returned a non-zero count
+        void take() noexcept {
+            if (m_budget.load(std::memory_order_relaxed) != 0 && m_tokens > 0) {
+                --m_tokens;
+            }
+        }
+
+        /// Returns when the next token becomes available, empty if one is available now
+        [[nodiscard]] std::optional<Clock::time_point> nextToken() const noexcept {
+            auto budget = m_budget.load(std::memory_order_relaxed);
+            if (budget == 0 || m_tokens > 0) {
+                return std::nullopt;
+            }
+            return m_lastRefill + refillInterval(budget);
+        }
+
+    private:
+        [[nodiscard]] Clock::duration refillInterval(uint32_t budget) const noexcept {
+            return std::chrono::milliseconds(m_periodMs.load(std::memory_order_relaxed)) / budget;
+        }
+
+        std::atomic<uint32_t> m_budget = 5;
+        std::atomic<int64_t> m_periodMs = 20000;
+        uint32_t m_tokens = 5;
+        Clock::time_point m_lastRefill = Clock::now();
+    };
+}
+
+#endif // DISCORD_RPC_RATE_LIMITER_HPP
@@ -0,0 +1,87 @@
+#pragma once
+#ifndef DISCORD_RPC_RECONNECT_POLICY_HPP
+#define DISCORD_RPC_RECONNECT_POLICY_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <random>
+
+namespace discord {
+    /// @brief How the delay between connection attempts grows
+    enum class ReconnectStrategy {
+        DecorrelatedJitter, ///< Random delay between the initial one and three times the previous one
+        CappedExponential,  ///< Doubles with every attempt, `jitter` of it is randomized
+    };
+
+    /// @brief Settings of a `ReconnectPolicy`, see `RPCManager::setReconnectPolicy`
+    struct ReconnectOptions {
+        ReconnectStrategy strategy = ReconnectStrategy::DecorrelatedJitter;
+        std::chrono::milliseconds initialDelay{500};
+        std::chrono::milliseconds maxDelay{60'000};
+        double jitter = 0.5; ///< CappedExponential only: share of each delay that is randomized (0-1)
+    };
+
+    /// @brief Decides when the next connection attempt may start.
+    ///
+    /// Delays grow while attempts fail and start over once a connection proved healthy.
+    /// Times are on the steady clock, so wall clock changes don't stall or rush reconnects.
+    /// Attempts are made on the IO worker, the settings may be changed from any thread.
+    class ReconnectPolicy {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        explicit ReconnectPolicy(ReconnectOptions const& options = {}) noexcept;
+
+        ReconnectPolicy(ReconnectPolicy const&) = delete;
+        ReconnectPolicy& operator=(ReconnectPolicy const&) = delete;
+
+        /// @brief Changes the settings, the current delay starts over
+        void configure(ReconnectOptions const& options) noexcept;
+
+        /// @brief Whether an attempt may start now
+        [[nodiscard]] bool due(Clock::time_point now) const noexcept {
+            auto next = nextAttempt();
+            return !next || now >= *next;
+        }
+
+        /// @brief Records an attempt starting now and schedules the one after it
+        /// @return Delay until the next attempt may start
+        Clock::duration attempt(Clock::time_point now) noexcept;
+
+        /// @brief The connection is healthy, the next disconnect reconnects right away and delays start over
+        void reset() noexcept;
+
+        /// @brief Lets the next attempt start at `at` (right away by default), without forgetting the current delay
+        void expedite(std::optional<Clock::time_point> at = std::nullopt) noexcept;
+
+        /// @brief When the next attempt may start, empty if it may start right away
+        [[nodiscard]] std::optional<Clock::time_point> nextAttempt() const noexcept {
+            auto next = m_nextAttempt.load(std::memory_order_relaxed);
+            if (next == Immediately) {
+                return std::nullopt;
+            }
+            return Clock::time_point(Clock::duration(next));
+        }
+
+        /// @brief Attempts since the last healthy connection
+        [[nodiscard]] uint32_t attempts() const noexcept { return m_attempts.load(std::memory_order_relaxed); }
+
+    private:
+        /// Stored instead of a time when an attempt may start right away, never handed out as a time point
+        static constexpr Clock::rep Immediately = Clock::time_point::min().time_since_epoch().count();
+
+        mutable std::mutex m_mutex;
+        ReconnectOptions m_options;
+        Clock::duration m_delay{}; ///< Last delay handed out, zero before the first attempt
+        std::mt19937_64 m_generator{std::random_device{}()};
+
+        // readable without the lock, for stats and the IO worker's deadline
+        std::atomic<Clock::rep> m_nextAttempt = Immediately;
+        std::atomic<uint32_t> m_attempts = 0;
+    };
+}
+
+#endif // DISCORD_RPC_RECONNECT_POLICY_HPP
@@ -0,0 +1,91 @@
+#pragma once
+#ifndef DISCORD_RPC_STATS_HPP
+#define DISCORD_RPC_STATS_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+namespace discord {
+    /// @brief Latency distribution with power-of-two microsecond buckets.
+    ///
+    /// Bucket 0 counts latencies below 1us, bucket i those in [2^(i-1), 2^i) us,
+    /// the last bucket everything above (~8.4 s).
+    struct LatencyHistogram {
+        static constexpr size_t Buckets = 24;
+
+        std::array<uint64_t, Buckets> counts{};
+        uint64_t count = 0;
+        std::chrono::nanoseconds total{};
+
+        /// @brief Bucket a latency falls into
+        static constexpr size_t bucketOf(std::chrono::nanoseconds latency) noexcept {
+            auto us = static_cast<uint64_t>(std::max<int64_t>(latency.count(), 0)) / 1000;
+            size_t bucket = 0;
+            while (us != 0 && bucket < Buckets - 1) {
+                us >>= 1;
+                ++bucket;
+            }
+            return bucket;
+        }
+
+        /// @brief Upper bound of a bucket
+        static constexpr std::chrono::microseconds upperBound(size_t bucket) noexcept {
+            return std::chrono::microseconds(uint64_t(1) << bucket);
+        }
+
+        [[nodiscard]] std::chrono::nanoseconds mean() const noexcept {
+            return count ? total / static_cast<int64_t>(count) : std::chrono::nanoseconds{};
+        }
+
+        /// @brief Upper bound of the bucket containing the given percentile (0-100)
+        [[nodiscard]] std::chrono::microseconds percentile(double p) const noexcept {
+            auto target = static_cast<uint64_t>(static_cast<double>(count) * p / 100.0);
+            uint64_t seen = 0;
+            for (size_t i = 0; i < Buckets; ++i) {
+                seen += counts[i];
+                if (seen > target) {
+                    return upperBound(i);
+                }
+            }
+            return upperBound(Buckets - 1);
+        }
+    };
+
+    /// @brief Snapshot of the library's counters, see `RPCManager::stats()`.
+    /// Counters are read one by one without locking, so they may be off by an in-flight operation.
+    struct Stats {
+        // IPC traffic, including the handshake and ping/pong
+        uint64_t framesSent = 0;
+        uint64_t bytesSent = 0;
+        uint64_t framesReceived = 0;
+        uint64_t bytesReceived = 0;
+
+        // presence serialization in refresh() and clearPresence()
+        uint64_t serializations = 0;
+        std::chrono::nanoseconds serializationTime{};
+
+        // commands waiting to be sent
+        size_t queueDepth = 0;
+        size_t queueHighWater = 0;
+        uint64_t rejectedCommands = 0; ///< Commands and presences too large for one frame, failed without being queued
+
+        // connection
+        uint64_t reconnectAttempts = 0;
+        uint64_t reconnects = 0;
+        std::chrono::nanoseconds lastConnectToReady{};
+        uint32_t attemptsSinceReady = 0; ///< Connection attempts since the last READY, see `RPCManager::setReconnectPolicy`
+        /// When the next connection attempt may start, empty while connected and right after a disconnect
+        std::optional<std::chrono::steady_clock::time_point> nextReconnect;
+
+        /// Time from writing SET_ACTIVITY until Discord acknowledged it
+        LatencyHistogram presenceAck;
+        /// Time from sendCommand() until its response arrived
+        LatencyHistogram commandLatency;
+    };
+}
+
+#endif // DISCORD_RPC_STATS_HPP
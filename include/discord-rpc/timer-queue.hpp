@@ -0,0 +1,58 @@
+#pragma once
+#ifndef DISCORD_RPC_TIMER_QUEUE_HPP
+#define DISCORD_RPC_TIMER_QUEUE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace discord {
+    /// @brief One-shot timers run by the IO worker, kept in a min-heap so it can sleep until exactly the next one.
+    ///
+    /// Timers may be scheduled and cancelled from any thread, callbacks run on the thread calling runDue().
+    class TimerQueue {
+    public:
+        using Clock = std::chrono::steady_clock;
+        using TimerID = uint64_t;
+
+        TimerQueue() noexcept = default;
+
+        TimerQueue(TimerQueue const&) = delete;
+        TimerQueue& operator=(TimerQueue const&) = delete;
+
+        /// @brief Runs `callback` once `deadline` has passed
+        /// @return Handle for cancel(), never 0
+        TimerID schedule(Clock::time_point deadline, std::function<void()> callback);
+
+        /// @return false if the timer already ran or was cancelled
+        bool cancel(TimerID id) noexcept;
+
+        /// @brief Deadline of the earliest timer, empty if there are none
+        std::optional<Clock::time_point> next() const noexcept;
+
+        /// @brief Runs every timer whose deadline is at or before `now`, in deadline order
+        /// @return Number of callbacks run
+        size_t runDue(Clock::time_point now);
+
+    private:
+        struct Entry {
+            Clock::time_point deadline;
+            TimerID id;
+            std::function<void()> callback;
+
+            /// Inverted, so the standard max-heap functions keep the earliest deadline on top
+            bool operator<(Entry const& other) const noexcept {
+                return deadline != other.deadline ? deadline > other.deadline : id > other.id;
+            }
+        };
+
+        mutable std::mutex m_mutex;
+        std::vector<Entry> m_heap;
+        TimerID m_nextID = 1;
+    };
+}
+
+#endif // DISCORD_RPC_TIMER_QUEUE_HPP
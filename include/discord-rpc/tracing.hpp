@@ -0,0 +1,33 @@
+#pragma once
+#ifndef DISCORD_RPC_TRACING_HPP
+#define DISCORD_RPC_TRACING_HPP
+
+#include <chrono>
+
+namespace discord {
+    /// @brief Receives the library's trace zones, e.g. to forward them to Tracy or Perfetto.
+    ///
+    /// Zones are only emitted when the library is built with `DISCORD_ENABLE_TRACING`
+    /// (CMake option `DISCORD_RPC_ENABLE_TRACING`), otherwise they compile to nothing.
+    /// A backend writing Chrome trace files comes with `<discord-rpc/chrome-trace-writer.hpp>`.
+    /// Methods are called from the IO worker and from threads calling refresh(), names are string literals.
+    class TraceBackend {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        virtual ~TraceBackend() = default;
+
+        /// A zone starts on the calling thread
+        virtual void beginZone(char const* name) noexcept = 0;
+
+        /// The innermost zone on the calling thread ends
+        virtual void endZone(char const* name) noexcept = 0;
+
+        /// A span that is only known after the fact, e.g. the time a command waited in the queue
+        virtual void completeZone(char const* name, Clock::time_point start, Clock::time_point end) noexcept {
+            (void) name; (void) start; (void) end;
+        }
+    };
+}
+
+#endif // DISCORD_RPC_TRACING_HPP
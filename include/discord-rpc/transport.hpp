@@ -0,0 +1,124 @@
+#pragma once
+#ifndef DISCORD_RPC_TRANSPORT_HPP
+#define DISCORD_RPC_TRANSPORT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace discord {
+    /// A piece of a vectored write
+    struct IOBuffer {
+        void const* data;
+        size_t size;
+    };
+
+    /// @brief Byte stream the IPC protocol runs over, by default the platform's socket or named pipe.
+    ///
+    /// The library only calls it from the IO worker (or the thread calling update()), never concurrently.
+    /// See `RPCManager::setTransport`.
+    class Transport {
+    public:
+        virtual ~Transport() = default;
+
+        /// Connects to Discord
+        /// @return true once connected, false to be retried after the reconnect backoff
+        virtual bool open() noexcept = 0;
+
+        /// @return false if the transport wasn't open
+        virtual bool close() noexcept = 0;
+
+        [[nodiscard]] virtual bool isOpen() const noexcept = 0;
+
+        /// Descriptor the IO worker waits on for readability, -1 if the transport calls `wakeup()` instead
+        [[nodiscard]] virtual int handle() const noexcept { return -1; }
+
+        /// Whether `handle()` also signals writability, otherwise it becomes readable once a full transport has room
+        [[nodiscard]] virtual bool pollsWritable() const noexcept { return true; }
+
+        /// Writes as much of the buffers as the transport takes right away
+        /// @return Number of bytes written, 0 if it's full or was closed (see isOpen())
+        virtual size_t writeSome(std::span<IOBuffer const> buffers) noexcept = 0;
+
+        /// Reads as many bytes as are available, up to `capacity`
+        /// @return Number of bytes read, 0 if nothing is available or it was closed (see isOpen())
+        virtual size_t readSome(void* data, size_t capacity) noexcept = 0;
+
+        /// Set by the library, for transports without a `handle()` to signal that data arrived.
+        /// Safe while another thread calls `wakeup()`, the old function isn't running anymore once this returns.
+        void setWakeup(std::function<void()> wakeup) noexcept {
+            std::lock_guard lock(m_wakeupMutex);
+            m_wakeup = std::move(wakeup);
+        }
+
+    protected:
+        /// May be called from any thread, e.g. the peer's
+        void wakeup() const {
+            std::lock_guard lock(m_wakeupMutex);
+            if (m_wakeup) { m_wakeup(); }
+        }
+
+    private:
+        mutable std::mutex m_wakeupMutex;
+        std::function<void()> m_wakeup;
+    };
+
+    /// @brief In-memory transport for tests and benchmarks, no syscalls involved.
+    ///
+    /// The other end plays Discord: it takes what the library wrote with `peerRead()` and answers
+    /// with `peerWrite()`. Both ends may be used from different threads.
+    /// @note Only the IO is simulated. Debounce, rate limit, timeouts and reconnect delays still run on the
+    /// real steady clock, there's no virtual clock, so runs over it aren't deterministic simulations.
+    class LoopbackTransport final : public Transport {
+    public:
+        bool open() noexcept override;
+        bool close() noexcept override;
+        [[nodiscard]] bool isOpen() const noexcept override;
+        size_t writeSome(std::span<IOBuffer const> buffers) noexcept override;
+        size_t readSome(void* data, size_t capacity) noexcept override;
+
+        /// Whether open() succeeds, like a Discord client that is running or not (true by default)
+        void setListening(bool listening) noexcept;
+
+        /// Bytes buffered towards the peer before writes come up short, 0 for no limit
+        void setWriteCapacity(size_t capacity) noexcept;
+
+        /// Called on the library's thread after every write, so a simulated Discord can answer right away.
+        /// The transport isn't locked during the call, it may use the peer methods.
+        void setPeerHandler(std::function<void(LoopbackTransport&)> handler) noexcept;
+
+        /// Moves everything the library wrote so far to the end of `out`
+        /// @return Number of bytes moved
+        size_t peerRead(std::string& out);
+
+        /// Sends bytes to the library and wakes it up
+        /// @return false if the transport isn't open
+        bool peerWrite(std::string_view bytes);
+
+        /// Sends a whole IPC frame, `opcode` as in the protocol (0 handshake, 1 frame, 2 close, 3 ping, 4 pong)
+        bool peerWriteFrame(uint32_t opcode, std::string_view payload);
+
+        /// Drops the connection, the library sees the pipe closed on its next read
+        void peerClose();
+
+        /// Number of times open() succeeded
+        [[nodiscard]] size_t connections() const noexcept;
+
+    private:
+        mutable std::mutex m_mutex;
+        std::function<void(LoopbackTransport&)> m_peerHandler;
+        std::string m_toPeer;    ///< Written by the library, not yet read by the peer
+        std::string m_toLibrary; ///< Written by the peer
+        size_t m_readOffset = 0; ///< Bytes of m_toLibrary the library already read
+        size_t m_writeCapacity = 0;
+        size_t m_connections = 0;
+        bool m_listening = true;
+        bool m_open = false;
+    };
+}
+
+#endif // DISCORD_RPC_TRANSPORT_HPP
@@ -0,0 +1,83 @@
+#include <discord-rpc/chrome-trace-writer.hpp>
+
+#include <fstream>
+#include <functional>
+#include <thread>
+
+namespace discord {
+    /// Small, stable id of the calling thread, trace viewers group events by it
+    static uint32_t currentThreadID() noexcept {
+        thread_local uint32_t id = static_cast<uint32_t>(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+        return id;
+    }
+
+    ChromeTraceWriter::ChromeTraceWriter(size_t maxEvents) noexcept : m_maxEvents(maxEvents) {}
+
+    void ChromeTraceWriter::beginZone(char const* name) noexcept {
+        record(name, 'B', Clock::now());
+    }
+
+    void ChromeTraceWriter::endZone(char const* name) noexcept {
+        record(name, 'E', Clock::now());
+    }
+
+    void ChromeTraceWriter::completeZone(char const* name, Clock::time_point start, Clock::time_point end) noexcept {
+        record(name, 'X', start, end - start);
+    }
+
+    void ChromeTraceWriter::record(char const* name, char phase, Clock::time_point start, Clock::duration duration) noexcept {
+        using std::chrono::duration_cast;
+        using std::chrono::microseconds;
+
+        Event event{
+            name, phase, currentThreadID(),
+            duration_cast<microseconds>(start - m_epoch).count(),
+            duration_cast<microseconds>(duration).count()
+        };
+
+        std::lock_guard lock(m_mutex);
+        if (m_events.size() >= m_maxEvents) {
+            return;
+        }
+
+        // tracing must never take the library down, an event that can't be stored is dropped
+        try {
+            m_events.push_back(event);
+        } catch (...) {}
+    }
+
+    void ChromeTraceWriter::write(std::ostream& out) const {
+        std::lock_guard lock(m_mutex);
+        out << R"({"displayTimeUnit":"ms","traceEvents":[)";
+        for (size_t i = 0; i < m_events.size(); ++i) {
+            auto const& event = m_events[i];
+            if (i != 0) { out << ','; }
+
+            // zone names are identifiers chosen by the library, they never need escaping
+            out << R"({"name":")" << event.name
+                << R"(","cat":"discord-rpc","ph":")" << event.phase
+                << R"(","pid":1,"tid":)" << event.thread
+                << R"(,"ts":)" << event.start;
+            if (event.phase == 'X') {
+                out << R"(,"dur":)" << event.duration;
+            }
+            out << '}';
+        }
+        out << "]}\n";
+    }
+
+    bool ChromeTraceWriter::save(std::string const& path) const {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            return false;
+        }
+
+        write(file);
+        return static_cast<bool>(file);
+    }
+
+    void ChromeTraceWriter::clear() noexcept {
+        std::lock_guard lock(m_mutex);
+        m_events.clear();
+    }
+}
@@ -1,43 +1,372 @@
 #include <discord-rpc/command-queue.hpp>
-#include <fmt/format.h>
+
+#include <algorithm>
+#include <bit>
+#include <utility>
 
 namespace discord {
-    void CommandQueue::push(std::string const& command) noexcept {
-        std::lock_guard lock(m_mutex);
-        m_queue.push(command);
+    CommandQueue::CommandQueue(size_t capacity) noexcept {
+        capacity = std::bit_ceil(std::max<size_t>(capacity, 2));
+        m_slots = std::make_unique<Slot[]>(capacity);
+        m_mask = capacity - 1;
+        for (size_t i = 0; i < capacity; ++i) {
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        m_spare.reserve(MaxSpareBuffers);
+        m_batch.reserve(capacity);
     }
 
-    void CommandQueue::push(std::string&& command) noexcept {
-        std::lock_guard lock(m_mutex);
-        m_queue.push(std::move(command));
+    CommandQueue::~CommandQueue() noexcept {
+        delete m_overflow.load(std::memory_order_acquire);
     }
 
-    std::string& CommandQueue::prepare() noexcept {
-        m_mutex.lock();
-        return m_queue.emplace();
+    bool CommandQueue::push(std::string const& command, CommandType type, int nonce) noexcept {
+        std::string copy = command;
+        return this->submit(copy, type, nonce);
     }
 
-    void CommandQueue::finish() noexcept {
-        m_mutex.unlock();
+    bool CommandQueue::push(std::string&& command, CommandType type, int nonce) noexcept {
+        return this->submit(command, type, nonce);
     }
 
-    std::optional<std::string> CommandQueue::pop() noexcept {
-        std::lock_guard lock(m_mutex);
-        if (m_queue.empty()) {
-            return std::nullopt;
+    bool CommandQueue::submit(std::string& command, CommandType type, int nonce) noexcept {
+        // a producer stalled between claiming a slot and publishing it mustn't overtake newer activities
+        uint64_t order = 0;
+        if (type == CommandType::Activity) {
+            order = m_activityOrder.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // claim a slot
+        Slot* slot;
+        auto pos = m_tail.load(std::memory_order_relaxed);
+        while (true) {
+            slot = &m_slots[pos & m_mask];
+            auto seq = slot->sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+            if (diff == 0) {
+                if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // consumer hasn't freed this slot yet, the newest activity still mustn't be lost
+                return type == CommandType::Activity && overflow(command, order);
+            } else {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+
+        // the slot holds a recycled buffer, which the caller gets back
+        std::swap(slot->command, command);
+        command.clear();
+        slot->type = type;
+        slot->order = order;
+        slot->nonce = nonce;
+        slot->queuedAt = Clock::now();
+
+        // publish
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool CommandQueue::overflow(std::string& command, uint64_t order) noexcept {
+        if (!m_coalesce.load(std::memory_order_relaxed)) {
+            return false;
+        }
+
+        auto* entry = new(std::nothrow) Overflow{std::move(command), order, Clock::now()};
+        if (!entry) {
+            return false;
         }
-        auto cmd = std::move(m_queue.front());
-        m_queue.pop();
-        return cmd;
+        command.clear();
+
+        // whoever swaps an activity out owns it, a newer one taken out by mistake is put back.
+        // Once published, `entry` may be freed by someone else, only its order is remembered.
+        while (auto* replaced = m_overflow.exchange(entry, std::memory_order_acq_rel)) {
+            if (replaced->order < order) {
+                m_superseded.fetch_add(1, std::memory_order_relaxed);
+                delete replaced;
+                break;
+            }
+            entry = replaced;
+            order = replaced->order;
+        }
+        return true;
+    }
+
+    void CommandQueue::setLimits(size_t capacity, QueuePolicy policy) noexcept {
+        m_limit.store(std::max<size_t>(capacity, 1), std::memory_order_relaxed);
+        m_policy.store(policy, std::memory_order_relaxed);
+    }
+
+    void CommandQueue::setCoalescing(bool enabled, std::chrono::milliseconds debounce) noexcept {
+        m_debounceMs.store(debounce.count(), std::memory_order_relaxed);
+        m_coalesce.store(enabled, std::memory_order_relaxed);
+    }
+
+    void CommandQueue::collect() noexcept {
+        bool coalesce = m_coalesce.load(std::memory_order_relaxed);
+        auto debounce = std::chrono::milliseconds(m_debounceMs.load(std::memory_order_relaxed));
+        reclaimActivity();
+        m_evictable = m_batch.size();
+
+        // flush the held back activity so it isn't lost when coalescing is turned off
+        if (!coalesce && m_hasActivity) {
+            m_hasActivity = false;
+            append(std::exchange(m_activity, takeSpare()), CommandType::Activity, m_activityQueuedAt);
+        }
+
+        while (true) {
+            auto& slot = m_slots[m_head & m_mask];
+            if (slot.sequence.load(std::memory_order_acquire) != m_head + 1) {
+                break;
+            }
+
+            if (coalesce && slot.type == CommandType::Activity) {
+                if (supersedes(slot.order)) {
+                    // the replaced activity's buffer goes back to the producers
+                    std::swap(m_activity, slot.command);
+                    m_hasActivity = true;
+                    m_activityReadyAt = slot.queuedAt + debounce;
+                    m_activityQueuedAt = slot.queuedAt;
+                }
+                slot.command.clear();
+            } else {
+                append(std::exchange(slot.command, takeSpare()), slot.type, slot.queuedAt, slot.nonce);
+            }
+
+            // hand the slot back to producers
+            slot.sequence.store(m_head + m_mask + 1, std::memory_order_release);
+            ++m_head;
+        }
+
+        collectOverflow(coalesce, debounce);
+    }
+
+    void CommandQueue::collectOverflow(bool coalesce, std::chrono::milliseconds debounce) noexcept {
+        if (!m_overflow.load(std::memory_order_relaxed)) {
+            return;
+        }
+
+        std::unique_ptr<Overflow> entry(m_overflow.exchange(nullptr, std::memory_order_acq_rel));
+        if (!entry) {
+            return;
+        }
+
+        if (!coalesce) {
+            // coalescing was turned off since, it's just the newest command
+            append(std::move(entry->command), CommandType::Activity, entry->queuedAt);
+            return;
+        }
+
+        // producers may have filled freed slots after it overflowed
+        if (!supersedes(entry->order)) {
+            return;
+        }
+
+        recycle(std::exchange(m_activity, std::move(entry->command)));
+        m_hasActivity = true;
+        m_activityReadyAt = entry->queuedAt + debounce;
+        m_activityQueuedAt = entry->queuedAt;
+    }
+
+    bool CommandQueue::supersedes(uint64_t order) noexcept {
+        if (order < m_newestActivity) {
+            m_superseded.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        if (m_hasActivity) {
+            m_superseded.fetch_add(1, std::memory_order_relaxed);
+        }
+        m_newestActivity = order;
+        return true;
+    }
+
+    void CommandQueue::prune() noexcept {
+        collect();
+
+        // only the newest activity is worth replaying, the held back one is newer than the whole batch
+        size_t keepActivity = m_batch.size();
+        if (!m_hasActivity) {
+            for (size_t i = m_batch.size(); i-- > 0;) {
+                if (m_batch[i].type == CommandType::Activity) {
+                    keepActivity = i;
+                    break;
+                }
+            }
+        }
+
+        // other commands are somebody's request, they're only dropped by the capacity
+        size_t kept = 0;
+        for (size_t i = 0; i < m_batch.size(); ++i) {
+            auto& entry = m_batch[i];
+            if (entry.type == CommandType::Activity && i != keepActivity) {
+                discard(std::move(entry.command), entry.nonce);
+                continue;
+            }
+
+            if (kept != i) {
+                std::swap(m_batch[kept], entry);
+            }
+            ++kept;
+        }
+        m_batch.resize(kept);
+    }
+
+    std::span<CommandQueue::Entry> CommandQueue::drain(bool includeActivity) noexcept {
+        collect();
+
+        // the coalesced activity joins the batch once it's ready, behind everything queued before it.
+        // It stays coalesced until it was sent, the capacity already counts it.
+        m_activityStalled = false;
+        if (includeActivity && m_hasActivity && Clock::now() >= m_activityReadyAt) {
+            m_batch.push_back({std::exchange(m_activity, takeSpare()), CommandType::Activity, 0, m_activityQueuedAt});
+            m_activityLent = true;
+        }
+
+        return m_batch;
+    }
+
+    size_t CommandQueue::deferActivities(size_t budget) noexcept {
+        // the lent activity is the newest one, so it stays the last entry
+        size_t allowed = 0;
+        for (size_t i = 0; i < m_batch.size(); ++i) {
+            if (m_batch[i].type == CommandType::Activity) {
+                if (budget == 0) { continue; }
+                --budget;
+            }
+
+            if (allowed != i) {
+                auto first = m_batch.begin() + static_cast<std::ptrdiff_t>(allowed);
+                auto entry = m_batch.begin() + static_cast<std::ptrdiff_t>(i);
+                std::rotate(first, entry, entry + 1);
+            }
+            ++allowed;
+        }
+        return allowed;
+    }
+
+    void CommandQueue::consume(size_t count) noexcept {
+        count = std::min(count, m_batch.size());
+        if (m_activityLent && count == m_batch.size()) {
+            m_activityLent = false;
+            m_hasActivity = false;
+        } else if (m_activityLent) {
+            // waits for the pipe (or a token), a deadline for it would only spin the IO worker
+            reclaimActivity();
+            m_activityStalled = true;
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            recycle(std::move(m_batch[i].command));
+        }
+        m_batch.erase(m_batch.begin(), m_batch.begin() + static_cast<std::ptrdiff_t>(count));
+    }
+
+    bool CommandQueue::pop(std::string& command) noexcept {
+        auto batch = drain();
+        if (batch.empty()) {
+            return false;
+        }
+
+        std::swap(command, batch.front().command);
+        consume(1);
+        return true;
     }
 
     bool CommandQueue::empty() const noexcept {
-        std::lock_guard lock(m_mutex);
-        return m_queue.empty();
+        return this->size() == 0;
     }
 
     size_t CommandQueue::size() const noexcept {
-        std::lock_guard lock(m_mutex);
-        return m_queue.size();
+        auto inRing = m_tail.load(std::memory_order_acquire) - m_head;
+        auto overflowed = m_overflow.load(std::memory_order_relaxed) ? 1 : 0;
+        return inRing + overflowed + m_batch.size() + (m_hasActivity && !m_activityLent ? 1 : 0);
+    }
+
+    bool CommandQueue::holdsActivity() const noexcept {
+        return m_hasActivity || std::any_of(m_batch.begin(), m_batch.end(), [](Entry const& entry) {
+            return entry.type == CommandType::Activity;
+        });
+    }
+
+    std::optional<CommandQueue::Clock::time_point> CommandQueue::pendingDeadline() const noexcept {
+        if (!m_hasActivity || m_activityStalled) {
+            return std::nullopt;
+        }
+        return m_activityReadyAt;
+    }
+
+    std::string CommandQueue::takeSpare() noexcept {
+        if (m_spare.empty()) {
+            return {};
+        }
+
+        auto buffer = std::move(m_spare.back());
+        m_spare.pop_back();
+        return buffer;
+    }
+
+    void CommandQueue::recycle(std::string&& buffer) noexcept {
+        if (m_spare.size() < MaxSpareBuffers && buffer.capacity() > 0) {
+            buffer.clear();
+            m_spare.push_back(std::move(buffer));
+        }
+    }
+
+    void CommandQueue::reclaimActivity() noexcept {
+        if (!m_activityLent) {
+            return;
+        }
+
+        m_activityLent = false;
+        recycle(std::exchange(m_activity, std::move(m_batch.back().command)));
+        m_batch.pop_back();
+    }
+
+    void CommandQueue::append(std::string&& command, CommandType type, Clock::time_point queuedAt, int nonce) noexcept {
+        // a held presence alone doesn't keep a command out, there's nothing it could be traded for
+        auto held = m_batch.size() + (m_hasActivity ? 1 : 0);
+        if (held >= m_limit.load(std::memory_order_relaxed) && !m_batch.empty()) {
+            auto evict = m_batch.end();
+            switch (m_policy.load(std::memory_order_relaxed)) {
+                case QueuePolicy::KeepLatestPresence:
+                    if (type == CommandType::Activity) {
+                        evict = std::find_if(m_batch.begin(), m_batch.end(), [](Entry const& entry) {
+                            return entry.type == CommandType::Activity;
+                        });
+                    }
+                    break;
+                case QueuePolicy::DropOldest:
+                    // commands collected along with this one weren't even tried yet
+                    if (m_evictable > 0) {
+                        evict = m_batch.begin();
+                    }
+                    break;
+                case QueuePolicy::Reject:
+                    break;
+            }
+
+            if (evict == m_batch.end()) {
+                discard(std::move(command), nonce);
+                return;
+            }
+
+            if (evict - m_batch.begin() < static_cast<std::ptrdiff_t>(m_evictable)) {
+                --m_evictable;
+            }
+            discard(std::move(evict->command), evict->nonce);
+            m_batch.erase(evict);
+        }
+
+        m_batch.push_back({std::move(command), type, nonce, queuedAt});
+    }
+
+    void CommandQueue::discard(std::string&& command, int nonce) noexcept {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        if (nonce != 0) {
+            m_droppedNonces.push_back(nonce);
+        }
+        recycle(std::move(command));
     }
-}
\ No newline at end of file
+}
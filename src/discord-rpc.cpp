@@ -1,14 +1,27 @@
 #include <discord-rpc.hpp>
 
+#include <charconv>
+
 #ifndef DISCORD_DISABLE_IO_THREAD
 #include <condition_variable>
 #include <thread>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#endif
 #endif
 
 #include "platform/platform.hpp"
+#if !defined(DISCORD_DISABLE_IO_THREAD) && defined(__linux__)
+#include "platform/socket-watcher.hpp"
+#endif
 
-#include "backoff.hpp"
+#include "flight-recorder.hpp"
+#include "metrics.hpp"
 #include "rpc-connection.hpp"
+#include "tracing.hpp"
 
 namespace discord {
     #ifdef DISCORD_DISABLE_IO_THREAD
@@ -17,6 +30,205 @@ namespace discord {
         void stop() {}
         void notify() {}
     };
+    #elif defined(__linux__)
+    /// Blocks in epoll_wait on the IPC socket and an eventfd signalled by refresh(),
+    /// so IO happens as soon as it's possible and an idle client never wakes up.
+    /// Deadlines are waited for with a timerfd armed at the exact time, epoll's timeout is only good to a millisecond.
+    /// While disconnected, it also waits for Discord's socket to appear and connects right away.
+    struct IOWorker {
+        IOWorker() noexcept = default;
+        ~IOWorker() noexcept { stop(); }
+
+        void start() {
+            m_epoll = ::epoll_create1(EPOLL_CLOEXEC);
+            m_event = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (m_epoll != -1 && m_event != -1) {
+                epoll_event ev{};
+                ev.events = EPOLLIN;
+                ev.data.fd = m_event;
+                ::epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_event, &ev);
+                m_watcher.start();
+
+                m_timer = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+                if (m_timer != -1) {
+                    ev.data.fd = m_timer;
+                    ::epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_timer, &ev);
+                }
+            }
+
+            m_running.store(true);
+            m_thread = std::thread(
+                [this]() {
+                    auto& rpc = RPCManager::get();
+                    rpc.update();
+                    while (m_running.load()) {
+                        watchSocket();
+                        watchDiscovery();
+                        wait(rpc.nextDeadline());
+                        rpc.update();
+                    }
+                }
+            );
+        }
+
+        void stop() {
+            m_running.store(false);
+            notify();
+            if (m_thread.joinable()) {
+                m_thread.join();
+            }
+
+            if (m_epoll != -1) { ::close(m_epoll); m_epoll = -1; }
+            if (m_event != -1) { ::close(m_event); m_event = -1; }
+            if (m_timer != -1) { ::close(m_timer); m_timer = -1; }
+            m_watcher.stop();
+            m_socket = -1;
+            m_generation = 0;
+            m_watching = false;
+        }
+
+        void notify() {
+            if (m_event != -1) {
+                uint64_t one = 1;
+                [[maybe_unused]] auto res = ::write(m_event, &one, sizeof(one));
+            }
+        }
+
+    private:
+        /// Keeps the current IPC socket registered, it changes on every reconnect.
+        /// Writability is only watched while there's output the socket didn't take.
+        /// The connection's generation tells a reopened socket apart from the closed one when the kernel reuses its number.
+        void watchSocket() {
+            auto& conn = Connection::get();
+            auto socket = conn.transport().handle();
+            auto generation = conn.generation();
+            bool wantsWrite = socket != -1 && conn.wantsWrite() && conn.transport().pollsWritable();
+            bool reopened = generation != m_generation;
+            if ((socket == m_socket && !reopened && wantsWrite == m_wantsWrite) || m_epoll == -1) {
+                return;
+            }
+
+            epoll_event ev{};
+            ev.events = EPOLLIN | EPOLLRDHUP;
+            ev.data.fd = socket;
+            if (wantsWrite) {
+                ev.events |= EPOLLOUT;
+            }
+
+            if (socket == m_socket && !reopened) {
+                ::epoll_ctl(m_epoll, EPOLL_CTL_MOD, m_socket, &ev);
+                m_wantsWrite = wantsWrite;
+                return;
+            }
+
+            // a closed socket is removed from the set by the kernel, this is just for bookkeeping
+            if (m_socket != -1) {
+                ::epoll_ctl(m_epoll, EPOLL_CTL_DEL, m_socket, nullptr);
+            }
+
+            m_socket = socket;
+            m_generation = generation;
+            m_wantsWrite = wantsWrite;
+            if (m_socket != -1) {
+                ::epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_socket, &ev);
+            }
+        }
+
+        /// Only listens for new sockets while disconnected, other files created in the runtime directory
+        /// would wake up a connected client for nothing
+        void watchDiscovery() {
+            bool wanted = m_watcher.handle() != -1 && Connection::get().isDisconnected();
+            if (wanted == m_watching) {
+                return;
+            }
+
+            m_watching = wanted;
+            if (!wanted) {
+                ::epoll_ctl(m_epoll, EPOLL_CTL_DEL, m_watcher.handle(), nullptr);
+                return;
+            }
+
+            // whatever was created while connected is old news
+            m_watcher.poll();
+
+            epoll_event ev{};
+            ev.events = EPOLLIN;
+            ev.data.fd = m_watcher.handle();
+            ::epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_watcher.handle(), &ev);
+        }
+
+        /// Arms the timerfd for `deadline` (steady_clock is CLOCK_MONOTONIC), or disarms it
+        void armTimer(std::optional<CommandQueue::Clock::time_point> deadline) {
+            if (deadline == m_armed) {
+                return;
+            }
+
+            itimerspec spec{};
+            if (deadline) {
+                auto since = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline->time_since_epoch());
+                // a zero it_value would disarm the timer instead
+                since = std::max(since, std::chrono::nanoseconds(1));
+                spec.it_value.tv_sec = static_cast<time_t>(since.count() / 1'000'000'000);
+                spec.it_value.tv_nsec = static_cast<long>(since.count() % 1'000'000'000);
+            }
+
+            if (::timerfd_settime(m_timer, TFD_TIMER_ABSTIME, &spec, nullptr) == 0) {
+                m_armed = deadline;
+            }
+        }
+
+        void wait(std::optional<CommandQueue::Clock::time_point> deadline) {
+            int timeout = -1;
+            if (deadline) {
+                // compared before subtracting, a far away deadline would overflow the difference
+                auto now = CommandQueue::Clock::now();
+                if (*deadline <= now) {
+                    timeout = 0;
+                } else if (m_timer == -1) {
+                    auto ms = std::chrono::ceil<std::chrono::milliseconds>(*deadline - now);
+                    timeout = static_cast<int>(std::clamp<int64_t>(ms.count(), 0, INT32_MAX));
+                }
+            }
+
+            if (m_timer != -1 && timeout == -1) {
+                armTimer(deadline);
+            }
+
+            if (m_epoll == -1) {
+                // couldn't set up epoll, fall back to polling
+                constexpr auto fallback = std::chrono::milliseconds(500);
+                std::this_thread::sleep_for(timeout < 0 ? fallback : std::min(fallback, std::chrono::milliseconds(timeout)));
+                return;
+            }
+
+            epoll_event events[3];
+            int count = ::epoll_wait(m_epoll, events, 3, timeout);
+            for (int i = 0; i < count; ++i) {
+                if (events[i].data.fd == m_event) {
+                    uint64_t value;
+                    [[maybe_unused]] auto res = ::read(m_event, &value, sizeof(value));
+                } else if (events[i].data.fd == m_timer) {
+                    uint64_t expirations;
+                    [[maybe_unused]] auto res = ::read(m_timer, &expirations, sizeof(expirations));
+                    m_armed.reset();
+                } else if (m_watching && events[i].data.fd == m_watcher.handle() && m_watcher.poll()) {
+                    RPCManager::get().connectNow();
+                }
+            }
+        }
+
+        std::thread m_thread{};
+        std::atomic_bool m_running = true;
+        int m_epoll = -1;
+        int m_event = -1;
+        int m_timer = -1;
+        std::optional<CommandQueue::Clock::time_point> m_armed; ///< Deadline the timerfd is set for
+        int m_socket = -1;
+        uint64_t m_generation = 0; ///< Connection generation `m_socket` was registered for
+        bool m_wantsWrite = false;
+        platform::SocketWatcher m_watcher;
+        bool m_watching = false;
+    };
     #else
     struct IOWorker {
         IOWorker() noexcept = default;
@@ -31,7 +243,19 @@ namespace discord {
                     rpc.update();
                     while (m_running.load()) {
                         std::unique_lock lock(m_waitForIO);
-                        m_ioReady.wait_for(lock, timeout);
+                        // the pipe can't be waited on, so it's polled while connected;
+                        // while disconnected, only deadlines (reconnect, timers) and refresh() can wake us
+                        auto deadline = rpc.nextDeadline();
+                        if (!Connection::get().isDisconnected()) {
+                            auto poll = CommandQueue::Clock::now() + timeout;
+                            deadline = deadline ? std::min(*deadline, poll) : poll;
+                        }
+
+                        if (deadline) {
+                            m_ioReady.wait_until(lock, *deadline);
+                        } else {
+                            m_ioReady.wait(lock);
+                        }
                         rpc.update();
                     }
                 }
@@ -114,6 +338,7 @@ namespace discord {
 
         Connection::get().close();
         m_initialized = false;
+        cancelWaiters();
 
         return *this;
     }
@@ -123,71 +348,784 @@ namespace discord {
             return *this;
         }
 
+        expireCommands(CommandQueue::Clock::now());
+        m_timers.runDue(CommandQueue::Clock::now());
+
         auto& conn = Connection::get();
         if (!conn.isOpen()) {
-            if (std::chrono::system_clock::now() < m_nextConnect) {
-                return *this;
+            // keep the ring drained and the backlog bounded while disconnected
+            m_commandQueue.prune();
+            failDroppedCommands();
+
+            // a handshake in progress is continued right away, only new attempts wait for the backoff
+            if (conn.isDisconnected()) {
+                if (!m_reconnectPolicy.due(CommandQueue::Clock::now())) {
+                    return *this;
+                }
+
+                DISCORD_TRACE_COMPLETE("reconnectBackoff", m_backoffStart, CommandQueue::Clock::now());
+                updateReconnectTime();
+                Metrics::get().connecting();
             }
 
-            updateReconnectTime();
+            // once READY arrives, subscriptions and queued commands go out right away
             conn.open(m_clientID);
-            return *this;
+            if (!conn.isDisconnected()) {
+                m_socketRetries = 0;
+            }
+            if (!conn.isOpen()) {
+                // Discord may take the connection and never answer the handshake
+                if (!conn.isDisconnected() && m_handshakeTimer == 0) {
+                    m_handshakeTimer = m_timers.schedule(CommandQueue::Clock::now() + HandshakeTimeout, [this] {
+                        m_handshakeTimer = 0;
+                        Connection::get().abortHandshake();
+                    });
+                }
+                return *this;
+            }
         }
 
         // reading
-        do {
-            std::string buffer;
-            if (!conn.read(buffer)) {
-                break;
-            }
+        std::string_view payload;
+        while (conn.read(payload)) {
+            dispatchEvent(payload);
+        }
 
-            // fmt::println("Received: {}", buffer);
-        } while (true);
+        syncSubscriptions();
 
         // writing
-        // using size to avoid going into infinite loop when requeuing commands
-        auto size = m_commandQueue.size();
-        if (size > 0) {
-            for (size_t i = 0; i < size; ++i) {
-                if (auto cmd = m_commandQueue.pop()) {
-                    if (!conn.write(*cmd)) {
-                        // requeue
-                        m_commandQueue.push(std::move(*cmd));
-                    }
+        // everything ready is taken in one go, unsent commands stay at the front in order
+        auto now = CommandQueue::Clock::now();
+        auto tokens = m_rateLimiter.available(now);
+        auto batch = m_commandQueue.drain(tokens > 0);
+
+        // SET_ACTIVITY past the budget waits for a token, other commands go ahead of it
+        size_t allowed = m_commandQueue.deferActivities(tokens);
+
+        auto deadline = m_commandQueue.pendingDeadline();
+        bool deferred = allowed < batch.size() || (tokens == 0 && deadline && *deadline <= now);
+        if (deferred && !m_activityDeferred) {
+            m_deferredUpdates.fetch_add(1, std::memory_order_relaxed);
+        }
+        m_activityDeferred = deferred;
+
+        auto& metrics = Metrics::get();
+        metrics.queueDepth(batch.size());
+
+        auto sent = conn.write(batch.first(allowed));
+        for (size_t i = 0; i < sent; ++i) {
+            DISCORD_TRACE_COMPLETE("queueWait", batch[i].queuedAt, now);
+            if (batch[i].type == CommandType::Activity) {
+                m_lastActivity.assign(batch[i].command);
+                m_rateLimiter.take();
+                if (m_presenceWrites.size() < MaxTrackedPresences) {
+                    m_presenceWrites.push_back(now);
                 }
             }
         }
+        m_commandQueue.consume(sent);
+        failDroppedCommands();
+        metrics.queueDepth(m_commandQueue.size());
 
         return *this;
     }
 
     RPCManager& RPCManager::refresh() noexcept {
-        // add the presence to queue
-        auto& msg = m_commandQueue.prepare();
-        serializePresence(msg, m_presence, m_processID, m_nonce++);
-        m_commandQueue.finish();
+        // each producer serializes into its own buffer without any lock, buffers are recycled by the queue
+        thread_local std::string buffer;
+        auto nonce = m_nonce.fetch_add(1, std::memory_order_relaxed);
+        auto start = Metrics::Clock::now();
+        auto activity = serializePresence(buffer, m_presence, m_processID, nonce);
+        Metrics::get().serialized(Metrics::Clock::now() - start);
+        if (!Connection::fitsInFrame(buffer, nonce)) {
+            return *this;
+        }
 
-        // notify the io worker
-        if (m_ioWorker) { m_ioWorker->notify(); }
+        // identical presence is dropped before it's queued
+        if (!updatePresenceFingerprint(activity)) {
+            return *this;
+        }
 
+        submitPresence(buffer);
         return *this;
     }
 
     RPCManager& RPCManager::clearPresence() noexcept {
         m_presence.clear();
 
+        // an empty activity has its own fingerprint, so repeated clears are dropped too
+        if (!updatePresenceFingerprint({})) {
+            return *this;
+        }
+
+        thread_local std::string buffer;
+        auto start = Metrics::Clock::now();
+        serializeEmptyPresence(buffer, m_processID, m_nonce.fetch_add(1, std::memory_order_relaxed));
+        Metrics::get().serialized(Metrics::Clock::now() - start);
+        submitPresence(buffer);
+        return *this;
+    }
+
+    bool RPCManager::submitPresence(std::string& buffer) noexcept {
         // add the presence to queue
-        auto& msg = m_commandQueue.prepare();
-        serializeEmptyPresence(msg, m_processID, m_nonce++);
-        m_commandQueue.finish();
+        bool queued = m_commandQueue.submit(buffer, CommandType::Activity);
+        if (!queued) {
+            // the queue is full and coalescing is off, make sure the next refresh isn't dropped as a duplicate
+            invalidatePresenceFingerprint();
+        }
 
         // notify the io worker
         if (m_ioWorker) { m_ioWorker->notify(); }
+        return queued;
+    }
+
+    void RPCManager::handleReady(User const& user) noexcept {
+        Metrics::get().connected();
+        cancelHandshakeTimer();
+
+        // the backoff only starts over for a connection that lasts
+        m_healthyTimer = m_timers.schedule(CommandQueue::Clock::now() + HealthyConnectionTime, [this] {
+            m_healthyTimer = 0;
+            m_reconnectPolicy.reset();
+        });
+        invalidatePresenceFingerprint();
+        invalidateSubscriptions();
+
+        // Discord forgot the presence with the last connection, unless a newer one is queued it's sent again.
+        // A refresh() from here on is newer and replaces it.
+        m_commandQueue.collect();
+        if (!m_lastActivity.empty() && !m_commandQueue.holdsActivity()) {
+            m_commandQueue.push(m_lastActivity, CommandType::Activity);
+        }
+        invokeOnReady(user);
+
+        std::vector<std::function<void(User)>> waiters;
+        {
+            std::lock_guard lock(m_awaitMutex);
+            m_connectedUser = user;
+            waiters.swap(m_connectWaiters);
+        }
 
+        for (auto& resume : waiters) {
+            resume(user);
+        }
+    }
+
+    void RPCManager::handleClosed(std::string_view reason) noexcept {
+        cancelHandshakeTimer();
+        if (m_healthyTimer != 0) {
+            m_timers.cancel(m_healthyTimer);
+            m_healthyTimer = 0;
+        }
+        {
+            std::lock_guard lock(m_awaitMutex);
+            m_connectedUser.reset();
+        }
+
+        m_presenceWrites.clear();
+
+        // a presence that was written may not have arrived, an identical refresh() has to go out again
+        invalidatePresenceFingerprint();
+        failCommands(reason);
+    }
+
+    void RPCManager::publishEvent(RPCEvent event) noexcept {
+        std::function<void(RPCEvent)> resume;
+        {
+            std::lock_guard lock(m_awaitMutex);
+            if (m_eventWaiters.empty()) {
+                if (m_bufferedEvents.size() >= MaxBufferedEvents) {
+                    m_bufferedEvents.pop_front();
+                }
+                m_bufferedEvents.push_back(std::move(event));
+                return;
+            }
+
+            resume = std::move(m_eventWaiters.front());
+            m_eventWaiters.pop_front();
+        }
+
+        resume(std::move(event));
+    }
+
+    void RPCManager::cancelWaiters() noexcept {
+        std::vector<std::function<void(User)>> connectWaiters;
+        std::deque<std::function<void(RPCEvent)>> eventWaiters;
+        {
+            std::lock_guard lock(m_awaitMutex);
+            connectWaiters.swap(m_connectWaiters);
+            eventWaiters.swap(m_eventWaiters);
+        }
+
+        for (auto& resume : connectWaiters) {
+            resume(User{});
+        }
+
+        for (auto& resume : eventWaiters) {
+            RPCEvent event;
+            event.type = RPCEvent::Type::Shutdown;
+            resume(std::move(event));
+        }
+    }
+
+    Awaitable<User> RPCManager::connected() {
+        return {
+            [this](Awaitable<User>::Complete complete) {
+                std::unique_lock lock(m_awaitMutex);
+                if (m_connectedUser) {
+                    auto user = *m_connectedUser;
+                    lock.unlock();
+                    complete(std::move(user));
+                    return;
+                }
+
+                m_connectWaiters.push_back(std::move(complete));
+            },
+            m_scheduler
+        };
+    }
+
+    Awaitable<CommandResponse> RPCManager::refreshAsync(std::chrono::milliseconds timeout) {
+        return {
+            [this, timeout](Awaitable<CommandResponse>::Complete complete) {
+                thread_local std::string buffer;
+                auto nonce = m_nonce.fetch_add(1, std::memory_order_relaxed);
+                auto start = Metrics::Clock::now();
+                auto activity = serializePresence(buffer, m_presence, m_processID, nonce);
+                Metrics::get().serialized(Metrics::Clock::now() - start);
+
+                if (!Connection::fitsInFrame(buffer, nonce)) {
+                    CommandResponse response;
+                    response.message = "Presence is too large to send";
+                    complete(std::move(response));
+                    return;
+                }
+
+                if (!updatePresenceFingerprint(activity)) {
+                    CommandResponse response;
+                    response.status = CommandResponse::Status::Success;
+                    complete(std::move(response));
+                    return;
+                }
+
+                registerCommand(nonce, complete, timeout, true);
+                if (!submitPresence(buffer)) {
+                    if (auto pending = takeCommand(nonce)) {
+                        CommandResponse response;
+                        response.message = "Command queue is full";
+                        complete(std::move(response));
+                    }
+                }
+            },
+            m_scheduler
+        };
+    }
+
+    Awaitable<CommandResponse> RPCManager::sendCommandAsync(
+        std::string_view command, std::string_view args, std::chrono::milliseconds timeout
+    ) {
+        // the views may be gone by the time the coroutine suspends
+        return {
+            [this, command = std::string(command), args = std::string(args), timeout](
+                Awaitable<CommandResponse>::Complete complete
+            ) {
+                sendCommand(command, args, std::move(complete), timeout);
+            },
+            m_scheduler
+        };
+    }
+
+    Awaitable<RPCEvent> RPCManager::nextEvent() {
+        if (!m_eventsAwaited.exchange(true)) {
+            // subscribe to everything once somebody is interested
+            if (m_ioWorker) { m_ioWorker->notify(); }
+        }
+
+        return {
+            [this](Awaitable<RPCEvent>::Complete complete) {
+                std::unique_lock lock(m_awaitMutex);
+                if (!m_bufferedEvents.empty()) {
+                    auto event = std::move(m_bufferedEvents.front());
+                    m_bufferedEvents.pop_front();
+                    lock.unlock();
+                    complete(std::move(event));
+                    return;
+                }
+
+                m_eventWaiters.push_back(std::move(complete));
+            },
+            m_scheduler
+        };
+    }
+
+    bool RPCManager::updatePresenceFingerprint(std::string_view activity) noexcept {
+        auto hash = hashPayload(activity);
+        bool resend = m_resendPresence.exchange(false);
+        if (!resend
+            && m_deduplicatePresence.load(std::memory_order_relaxed)
+            && hash == m_lastActivityHash.load(std::memory_order_relaxed)
+            && activity.size() == m_lastActivityLength.load(std::memory_order_relaxed)) {
+            return false;
+        }
+
+        m_lastActivityHash.store(hash, std::memory_order_relaxed);
+        m_lastActivityLength.store(activity.size(), std::memory_order_relaxed);
+        return true;
+    }
+
+    std::optional<CommandQueue::Clock::time_point> RPCManager::nextDeadline() const noexcept {
+        auto deadline = m_commandQueue.pendingDeadline();
+
+        // a held back presence can't go out before the rate limit allows it
+        auto token = m_rateLimiter.nextToken();
+        if (deadline && token) {
+            deadline = std::max(*deadline, *token);
+        } else if (!deadline && m_activityDeferred) {
+            deadline = token.value_or(CommandQueue::Clock::now());
+        }
+
+        {
+            std::lock_guard lock(m_pendingMutex);
+            if (!m_pendingCommands.empty()) {
+                deadline = deadline ? std::min(*deadline, m_nextTimeout) : m_nextTimeout;
+            }
+        }
+
+        if (auto timer = m_timers.next()) {
+            deadline = deadline ? std::min(*deadline, *timer) : *timer;
+        }
+
+        if (m_initialized && Connection::get().isDisconnected()) {
+            auto reconnect = m_reconnectPolicy.nextAttempt().value_or(CommandQueue::Clock::now());
+            deadline = deadline ? std::min(*deadline, reconnect) : reconnect;
+        }
+
+        return deadline;
+    }
+
+    std::vector<ProtocolEvent> RPCManager::recentProtocolEvents() const {
+        return FlightRecorder::get().snapshot();
+    }
+
+    std::string RPCManager::dumpProtocolEvents() const {
+        static constexpr std::string_view kinds[] = {"sent", "received", "state", "error"};
+        static constexpr std::string_view opcodes[] = {"HANDSHAKE", "FRAME", "CLOSE", "PING", "PONG"};
+        static constexpr std::string_view states[] = {"disconnected", "sent handshake", "awaiting response", "connected"};
+
+        auto events = recentProtocolEvents();
+        std::string dump;
+        auto last = events.empty() ? std::chrono::steady_clock::time_point{} : events.back().time;
+        for (auto const& event : events) {
+            // times are relative to the newest event, which is usually the failure
+            auto ago = std::chrono::duration<double, std::milli>(last - event.time).count();
+            auto kind = kinds[static_cast<size_t>(event.kind) & 3];
+            auto state = event.state < std::size(states) ? states[event.state] : "?";
+            switch (event.kind) {
+                case ProtocolEvent::Kind::Sent:
+                case ProtocolEvent::Kind::Received: {
+                    auto opcode = event.opcode < std::size(opcodes) ? opcodes[event.opcode] : "?";
+                    fmt::format_to(
+                        std::back_inserter(dump), "-{:.3f}ms {} {} {} bytes nonce {} ({})\n",
+                        ago, kind, opcode, event.size, event.nonce, state
+                    );
+                } break;
+                case ProtocolEvent::Kind::State: {
+                    fmt::format_to(std::back_inserter(dump), "-{:.3f}ms {} -> {}\n", ago, kind, state);
+                } break;
+                case ProtocolEvent::Kind::Error: {
+                    fmt::format_to(std::back_inserter(dump), "-{:.3f}ms {} {} ({})\n", ago, kind, event.error, state);
+                } break;
+            }
+        }
+        return dump;
+    }
+
+    void RPCManager::reportDiagnostics() const noexcept {
+        if (!m_onDiagnostics) {
+            return;
+        }
+
+        try {
+            m_onDiagnostics(dumpProtocolEvents());
+        } catch (...) {}
+    }
+
+    RPCManager& RPCManager::setTraceBackend(TraceBackend* backend) noexcept {
+        tracing::setBackend(backend);
         return *this;
     }
 
+    RPCManager& RPCManager::setTransport(Transport* transport) noexcept {
+        if (transport) {
+            transport->setWakeup([this] {
+                if (m_ioWorker) { m_ioWorker->notify(); }
+            });
+        }
+        Connection::get().setTransport(transport);
+        return *this;
+    }
+
+    RPCManager& RPCManager::setIOUring([[maybe_unused]] bool enabled) noexcept {
+        #ifdef DISCORD_HAS_IO_URING
+        platform::PipeConnection::get().setIOUring(enabled);
+        #endif
+        return *this;
+    }
+
+    Stats RPCManager::stats() const noexcept {
+        auto stats = Metrics::get().snapshot();
+        stats.attemptsSinceReady = m_reconnectPolicy.attempts();
+        stats.nextReconnect = m_reconnectPolicy.nextAttempt();
+        return stats;
+    }
+
+    RPCManager& RPCManager::setReconnectPolicy(ReconnectOptions const& options) noexcept {
+        m_reconnectPolicy.configure(options);
+        if (m_ioWorker) { m_ioWorker->notify(); }
+        return *this;
+    }
+
+    RPCManager& RPCManager::setRateLimit(uint32_t budget, std::chrono::milliseconds period) noexcept {
+        m_rateLimiter.configure(budget, period);
+        return *this;
+    }
+
+    uint64_t RPCManager::droppedUpdates() const noexcept {
+        return m_commandQueue.superseded() + m_commandQueue.dropped();
+    }
+
+    RPCManager& RPCManager::setSubscribed(uint8_t event, bool subscribed) noexcept {
+        if (subscribed) {
+            m_wantedEvents.fetch_or(event);
+        } else {
+            m_wantedEvents.fetch_and(static_cast<uint8_t>(~event));
+        }
+
+        if (m_ioWorker) { m_ioWorker->notify(); }
+        return *this;
+    }
+
+    void RPCManager::syncSubscriptions() noexcept {
+        static constexpr std::pair<uint8_t, std::string_view> events[] = {
+            {Event::ActivityJoin, "ACTIVITY_JOIN"},
+            {Event::ActivitySpectate, "ACTIVITY_SPECTATE"},
+            {Event::ActivityJoinRequest, "ACTIVITY_JOIN_REQUEST"},
+        };
+
+        auto wanted = m_eventsAwaited.load() ? AllEvents : m_wantedEvents.load();
+        if (wanted == m_subscribedEvents) {
+            return;
+        }
+
+        for (auto [event, name] : events) {
+            bool subscribe = wanted & event;
+            if (subscribe == bool(m_subscribedEvents & event)) {
+                continue;
+            }
+
+            std::string buffer;
+            auto nonce = m_nonce.fetch_add(1, std::memory_order_relaxed);
+            if (subscribe) {
+                serializeSubscribeCommand(buffer, nonce, name);
+            } else {
+                serializeUnsubscribeCommand(buffer, nonce, name);
+            }
+
+            // a full queue is retried on the next update
+            if (m_commandQueue.push(std::move(buffer))) {
+                m_subscribedEvents ^= event;
+            }
+        }
+    }
+
+    void RPCManager::dispatchEvent(std::string_view payload) noexcept {
+        // frames are parsed in place, the receive buffer isn't null-terminated
+        constexpr glz::opts opts{.error_on_unknown_keys = false, .null_terminated = false};
+
+        EventPacket packet;
+        if (glz::read<opts>(packet, payload) || !packet.cmd) {
+            return;
+        }
+
+        if (*packet.cmd != "DISPATCH") {
+            // a response to one of our commands
+            int nonce = 0;
+            if (packet.nonce) {
+                std::from_chars(packet.nonce->data(), packet.nonce->data() + packet.nonce->size(), nonce);
+            }
+
+            bool failed = packet.evt == "ERROR";
+            ErrorEvent error;
+            if (failed && glz::read<opts>(error, packet.data.str)) {
+                error = {};
+            }
+
+            auto pending = takeCommand(nonce);
+            bool isPresence = packet.cmd == "SET_ACTIVITY";
+            if (!pending && !isPresence) {
+                // nobody waits for this one (e.g. SUBSCRIBE), errors still shouldn't go unnoticed
+                if (failed) { invokeOnErrored(error.code, error.message); }
+                return;
+            }
+
+            CommandResponse response;
+            response.status = failed ? CommandResponse::Status::Error : CommandResponse::Status::Success;
+            response.code = error.code;
+            response.message = error.message;
+
+            if (isPresence && !m_presenceWrites.empty()) {
+                Metrics::get().presenceAcknowledged(CommandQueue::Clock::now() - m_presenceWrites.front());
+                m_presenceWrites.pop_front();
+            }
+
+            if (pending) {
+                response.data = packet.data.str;
+                response.latency = CommandQueue::Clock::now() - pending->sentAt;
+                Metrics::get().commandCompleted(response.latency);
+                if (pending->callback) { pending->callback(response); }
+            } else if (failed) {
+                invokeOnErrored(error.code, error.message);
+            }
+
+            if (isPresence) {
+                if (failed) {
+                    invalidatePresenceFingerprint();
+                }
+                completeSupersededPresences(nonce, response);
+            }
+            return;
+        }
+
+        if (!packet.evt) {
+            return;
+        }
+
+        auto evt = *packet.evt;
+        if (evt == "ACTIVITY_JOIN" || evt == "ACTIVITY_SPECTATE") {
+            SecretEvent event;
+            if (glz::read<opts>(event, packet.data.str)) {
+                return;
+            }
+
+            bool join = evt == "ACTIVITY_JOIN";
+            if (join) {
+                invokeOnJoinGame(event.secret);
+            } else {
+                invokeOnSpectateGame(event.secret);
+            }
+
+            if (m_eventsAwaited.load()) {
+                RPCEvent published;
+                published.type = join ? RPCEvent::Type::JoinGame : RPCEvent::Type::SpectateGame;
+                published.secret = event.secret;
+                publishEvent(std::move(published));
+            }
+        } else if (evt == "ACTIVITY_JOIN_REQUEST") {
+            // reused between requests, so the user's strings keep their capacity
+            thread_local JoinRequestEvent event;
+            event.user.global_name.reset();
+            event.user.avatar.reset();
+            event.user.bot = false;
+            event.user.flags = 0;
+            event.user.premium_type = 0;
+            if (glz::read<opts>(event, packet.data.str)) {
+                return;
+            }
+
+            invokeOnJoinRequest(event.user);
+
+            if (m_eventsAwaited.load()) {
+                RPCEvent published;
+                published.type = RPCEvent::Type::JoinRequest;
+                published.user = event.user;
+                publishEvent(std::move(published));
+            }
+        }
+    }
+
+    RPCManager& RPCManager::sendCommand(
+        std::string_view command, std::string_view args,
+        std::function<void(CommandResponse const&)> callback,
+        std::chrono::milliseconds timeout
+    ) noexcept {
+        auto nonce = m_nonce.fetch_add(1, std::memory_order_relaxed);
+        std::string buffer;
+        serializeCommand(buffer, nonce, command, args);
+        if (!Connection::fitsInFrame(buffer, nonce)) {
+            if (callback) {
+                CommandResponse response;
+                response.message = "Command is too large to send";
+                callback(response);
+            }
+            return *this;
+        }
+
+        registerCommand(nonce, std::move(callback), timeout);
+        if (!m_commandQueue.push(std::move(buffer), CommandType::Generic, nonce)) {
+            if (auto pending = takeCommand(nonce); pending && pending->callback) {
+                CommandResponse response;
+                response.message = "Command queue is full";
+                pending->callback(response);
+            }
+            return *this;
+        }
+
+        if (m_ioWorker) { m_ioWorker->notify(); }
+        return *this;
+    }
+
+    std::future<CommandResponse> RPCManager::sendCommand(
+        std::string_view command, std::string_view args, std::chrono::milliseconds timeout
+    ) {
+        auto promise = std::make_shared<std::promise<CommandResponse>>();
+        auto future = promise->get_future();
+        sendCommand(
+            command, args,
+            [promise](CommandResponse const& response) { promise->set_value(response); },
+            timeout
+        );
+        return future;
+    }
+
+    void RPCManager::registerCommand(
+        int nonce, std::function<void(CommandResponse const&)> callback,
+        std::chrono::milliseconds timeout, bool presence
+    ) noexcept {
+        auto now = CommandQueue::Clock::now();
+        std::lock_guard lock(m_pendingMutex);
+        m_pendingCommands[nonce] = {std::move(callback), now, now + timeout, presence};
+        m_nextTimeout = std::min(m_nextTimeout, now + timeout);
+        if (presence) { ++m_pendingPresences; }
+    }
+
+    std::optional<RPCManager::PendingCommand> RPCManager::takeCommand(int nonce) noexcept {
+        std::lock_guard lock(m_pendingMutex);
+        auto it = m_pendingCommands.find(nonce);
+        if (it == m_pendingCommands.end()) {
+            return std::nullopt;
+        }
+
+        auto pending = std::move(it->second);
+        m_pendingCommands.erase(it);
+        if (pending.presence) { --m_pendingPresences; }
+        return pending;
+    }
+
+    void RPCManager::completeSupersededPresences(int nonce, CommandResponse const& response) noexcept {
+        std::vector<PendingCommand> superseded;
+        {
+            std::lock_guard lock(m_pendingMutex);
+            if (m_pendingPresences == 0) {
+                return;
+            }
+
+            // presences are sent in nonce order, anything older that's still waiting was replaced
+            for (auto it = m_pendingCommands.begin(); it != m_pendingCommands.end();) {
+                if (it->second.presence && it->first < nonce) {
+                    superseded.push_back(std::move(it->second));
+                    it = m_pendingCommands.erase(it);
+                    --m_pendingPresences;
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        for (auto& pending : superseded) {
+            if (pending.callback) { pending.callback(response); }
+        }
+    }
+
+    void RPCManager::expireCommands(CommandQueue::Clock::time_point now) noexcept {
+        std::vector<PendingCommand> expired;
+        {
+            std::lock_guard lock(m_pendingMutex);
+            if (now < m_nextTimeout) {
+                return;
+            }
+
+            m_nextTimeout = CommandQueue::Clock::time_point::max();
+            for (auto it = m_pendingCommands.begin(); it != m_pendingCommands.end();) {
+                if (it->second.deadline <= now) {
+                    if (it->second.presence) { --m_pendingPresences; }
+                    expired.push_back(std::move(it->second));
+                    it = m_pendingCommands.erase(it);
+                } else {
+                    m_nextTimeout = std::min(m_nextTimeout, it->second.deadline);
+                    ++it;
+                }
+            }
+        }
+
+        // callbacks run without the lock, they may send more commands
+        for (auto& pending : expired) {
+            CommandResponse response;
+            response.status = CommandResponse::Status::Timeout;
+            response.message = "Timed out waiting for a response";
+            response.latency = now - pending.sentAt;
+            if (pending.callback) { pending.callback(response); }
+        }
+    }
+
+    void RPCManager::failCommands(std::string_view reason) noexcept {
+        std::unordered_map<int, PendingCommand> failed;
+        {
+            std::lock_guard lock(m_pendingMutex);
+            failed.swap(m_pendingCommands);
+            m_nextTimeout = CommandQueue::Clock::time_point::max();
+            m_pendingPresences = 0;
+        }
+
+        auto now = CommandQueue::Clock::now();
+        for (auto& [nonce, pending] : failed) {
+            CommandResponse response;
+            response.message = reason;
+            response.latency = now - pending.sentAt;
+            if (pending.callback) { pending.callback(response); }
+        }
+    }
+
+    void RPCManager::failDroppedCommands() noexcept {
+        for (auto nonce : m_commandQueue.takeDropped()) {
+            if (auto pending = takeCommand(nonce); pending && pending->callback) {
+                CommandResponse response;
+                response.message = "Dropped by the command queue";
+                response.latency = CommandQueue::Clock::now() - pending->sentAt;
+                pending->callback(response);
+            }
+        }
+    }
+
+    TimerQueue::TimerID RPCManager::schedule(std::chrono::steady_clock::time_point deadline, std::function<void()> callback) {
+        auto id = m_timers.schedule(deadline, std::move(callback));
+        if (m_ioWorker) { m_ioWorker->notify(); }
+        return id;
+    }
+
+    void RPCManager::cancelHandshakeTimer() noexcept {
+        if (m_handshakeTimer != 0) {
+            m_timers.cancel(m_handshakeTimer);
+            m_handshakeTimer = 0;
+        }
+    }
+
+    void RPCManager::connectNow() noexcept {
+        m_socketRetries = SocketRetries;
+        m_reconnectPolicy.expedite();
+    }
+
     void RPCManager::updateReconnectTime() noexcept {
-        m_nextConnect = std::chrono::system_clock::now() + std::chrono::milliseconds(Backoff::get().next());
+        auto now = CommandQueue::Clock::now();
+
+        // a socket that just appeared may not be listening yet, being refused says nothing about Discord's health
+        if (m_socketRetries > 0) {
+            --m_socketRetries;
+            m_reconnectPolicy.expedite(now + SocketRetryDelay);
+            return;
+        }
+
+
+        m_backoffStart = now;
+        m_reconnectPolicy.attempt(now);
     }
 }
@@ -0,0 +1,112 @@
+#pragma once
+#ifndef DISCORD_FLIGHT_RECORDER_HPP
+#define DISCORD_FLIGHT_RECORDER_HPP
+
+#include <discord-rpc/flight-recorder.hpp>
+
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <string_view>
+#include <vector>
+
+namespace discord {
+    /// Fixed-size ring of recent protocol events, always on.
+    /// Writers claim a slot with one fetch_add and publish it with a per-slot sequence (a seqlock),
+    /// so recording never blocks and readers can snapshot the ring from any thread.
+    class FlightRecorder {
+    public:
+        static constexpr size_t Capacity = 256;
+
+        static FlightRecorder& get() noexcept {
+            static FlightRecorder instance;
+            return instance;
+        }
+
+        void record(ProtocolEvent const& event) noexcept {
+            auto index = m_next.fetch_add(1, std::memory_order_relaxed);
+            auto& slot = m_slots[index % Capacity];
+
+            // odd while the slot is written, readers skip it
+            slot.sequence.store(index * 2 + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+
+            slot.time.store(event.time.time_since_epoch().count(), std::memory_order_relaxed);
+            slot.header.store(
+                uint64_t(event.kind) | uint64_t(event.opcode) << 8 | uint64_t(event.state) << 16 | uint64_t(event.size) << 32,
+                std::memory_order_relaxed
+            );
+            slot.codes.store(uint64_t(uint32_t(event.nonce)) | uint64_t(uint32_t(event.error)) << 32, std::memory_order_relaxed);
+
+            slot.sequence.store(index * 2 + 2, std::memory_order_release);
+        }
+
+        void record(ProtocolEvent::Kind kind, uint8_t opcode, uint8_t state, size_t size, int32_t nonce = 0, int32_t error = 0) noexcept {
+            record({
+                std::chrono::steady_clock::now(), kind, opcode, state,
+                static_cast<uint32_t>(size), nonce, error
+            });
+        }
+
+        /// Returns the recorded events, oldest first
+        [[nodiscard]] std::vector<ProtocolEvent> snapshot() const {
+            auto end = m_next.load(std::memory_order_acquire);
+            auto begin = end > Capacity ? end - Capacity : 0;
+
+            std::vector<ProtocolEvent> events;
+            events.reserve(end - begin);
+            for (auto index = begin; index < end; ++index) {
+                auto const& slot = m_slots[index % Capacity];
+                auto sequence = slot.sequence.load(std::memory_order_acquire);
+                auto time = slot.time.load(std::memory_order_relaxed);
+                auto header = slot.header.load(std::memory_order_relaxed);
+                auto codes = slot.codes.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+
+                // skip slots that are being written or were overwritten in the meantime
+                if (sequence != index * 2 + 2 || slot.sequence.load(std::memory_order_relaxed) != sequence) {
+                    continue;
+                }
+
+                ProtocolEvent event;
+                event.time = std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(time));
+                event.kind = static_cast<ProtocolEvent::Kind>(header & 0xff);
+                event.opcode = static_cast<uint8_t>(header >> 8);
+                event.state = static_cast<uint8_t>(header >> 16);
+                event.size = static_cast<uint32_t>(header >> 32);
+                event.nonce = static_cast<int32_t>(static_cast<uint32_t>(codes));
+                event.error = static_cast<int32_t>(static_cast<uint32_t>(codes >> 32));
+                events.push_back(event);
+            }
+            return events;
+        }
+
+        /// Nonce of a serialized command or response, found without parsing the JSON.
+        /// Our commands start with it, Discord puts it last in responses.
+        static int32_t findNonce(std::string_view payload) noexcept {
+            constexpr std::string_view key = R"("nonce":")";
+            auto pos = payload.starts_with("{" R"("nonce":")") ? 1 : payload.rfind(key);
+            if (pos == std::string_view::npos) {
+                return 0;
+            }
+
+            int32_t nonce = 0;
+            auto start = payload.data() + pos + key.size();
+            std::from_chars(start, payload.data() + payload.size(), nonce);
+            return nonce;
+        }
+
+    private:
+        struct Slot {
+            std::atomic<uint64_t> sequence = 0;
+            std::atomic<int64_t> time = 0;
+            std::atomic<uint64_t> header = 0; ///< kind | opcode << 8 | state << 16 | size << 32
+            std::atomic<uint64_t> codes = 0;  ///< nonce | error << 32
+        };
+
+        std::array<Slot, Capacity> m_slots{};
+        std::atomic<uint64_t> m_next = 0;
+    };
+}
+
+#endif // DISCORD_FLIGHT_RECORDER_HPP
@@ -0,0 +1,131 @@
+#pragma once
+#ifndef DISCORD_METRICS_HPP
+#define DISCORD_METRICS_HPP
+
+#include <discord-rpc/stats.hpp>
+
+#include <atomic>
+#include <chrono>
+
+namespace discord {
+    /// Counters behind `RPCManager::stats()`. Everything is a relaxed atomic, so recording
+    /// costs an uncontended add and reading never blocks the IO worker.
+    class Metrics {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        static Metrics& get() noexcept {
+            static Metrics instance;
+            return instance;
+        }
+
+        void frameSent(size_t bytes, uint64_t frames = 1) noexcept {
+            add(m_framesSent, frames);
+            add(m_bytesSent, bytes);
+        }
+
+        void bytesReceived(size_t bytes) noexcept { add(m_bytesReceived, bytes); }
+        void frameReceived() noexcept { add(m_framesReceived, 1); }
+
+        void serialized(Clock::duration time) noexcept {
+            add(m_serializations, 1);
+            add(m_serializationNs, std::chrono::duration_cast<std::chrono::nanoseconds>(time).count());
+        }
+
+        /// A command was too large to be sent as one frame
+        void commandRejected() noexcept { add(m_rejectedCommands, 1); }
+
+        void queueDepth(size_t depth) noexcept {
+            m_queueDepth.store(depth, std::memory_order_relaxed);
+            auto highWater = m_queueHighWater.load(std::memory_order_relaxed);
+            while (depth > highWater && !m_queueHighWater.compare_exchange_weak(highWater, depth, std::memory_order_relaxed)) {}
+        }
+
+        /// A new connection attempt was started, only called by the IO worker
+        void connecting() noexcept {
+            add(m_reconnectAttempts, 1);
+            m_connectStart = Clock::now();
+        }
+
+        /// READY arrived, only called by the IO worker
+        void connected() noexcept {
+            add(m_reconnects, 1);
+            m_connectToReadyNs.store(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - m_connectStart).count(),
+                std::memory_order_relaxed
+            );
+        }
+
+        void presenceAcknowledged(Clock::duration latency) noexcept { m_presenceAck.record(latency); }
+        void commandCompleted(Clock::duration latency) noexcept { m_commandLatency.record(latency); }
+
+        [[nodiscard]] Stats snapshot() const noexcept {
+            Stats stats;
+            stats.framesSent = load(m_framesSent);
+            stats.bytesSent = load(m_bytesSent);
+            stats.framesReceived = load(m_framesReceived);
+            stats.bytesReceived = load(m_bytesReceived);
+            stats.serializations = load(m_serializations);
+            stats.serializationTime = std::chrono::nanoseconds(load(m_serializationNs));
+            stats.queueDepth = m_queueDepth.load(std::memory_order_relaxed);
+            stats.queueHighWater = m_queueHighWater.load(std::memory_order_relaxed);
+            stats.rejectedCommands = load(m_rejectedCommands);
+            stats.reconnectAttempts = load(m_reconnectAttempts);
+            stats.reconnects = load(m_reconnects);
+            stats.lastConnectToReady = std::chrono::nanoseconds(load(m_connectToReadyNs));
+            stats.presenceAck = m_presenceAck.snapshot();
+            stats.commandLatency = m_commandLatency.snapshot();
+            return stats;
+        }
+
+    private:
+        struct Histogram {
+            std::array<std::atomic<uint64_t>, LatencyHistogram::Buckets> counts{};
+            std::atomic<uint64_t> count = 0;
+            std::atomic<uint64_t> totalNs = 0;
+
+            void record(Clock::duration latency) noexcept {
+                auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(latency);
+                add(counts[LatencyHistogram::bucketOf(ns)], 1);
+                add(count, 1);
+                add(totalNs, static_cast<uint64_t>(std::max<int64_t>(ns.count(), 0)));
+            }
+
+            [[nodiscard]] LatencyHistogram snapshot() const noexcept {
+                LatencyHistogram histogram;
+                for (size_t i = 0; i < counts.size(); ++i) {
+                    histogram.counts[i] = load(counts[i]);
+                }
+                histogram.count = load(count);
+                histogram.total = std::chrono::nanoseconds(load(totalNs));
+                return histogram;
+            }
+        };
+
+        static void add(std::atomic<uint64_t>& counter, uint64_t value) noexcept {
+            counter.fetch_add(value, std::memory_order_relaxed);
+        }
+
+        static uint64_t load(std::atomic<uint64_t> const& counter) noexcept {
+            return counter.load(std::memory_order_relaxed);
+        }
+
+        std::atomic<uint64_t> m_framesSent = 0;
+        std::atomic<uint64_t> m_bytesSent = 0;
+        std::atomic<uint64_t> m_framesReceived = 0;
+        std::atomic<uint64_t> m_bytesReceived = 0;
+        std::atomic<uint64_t> m_serializations = 0;
+        std::atomic<uint64_t> m_serializationNs = 0;
+        std::atomic<size_t> m_queueDepth = 0;
+        std::atomic<size_t> m_queueHighWater = 0;
+        std::atomic<uint64_t> m_rejectedCommands = 0;
+        std::atomic<uint64_t> m_reconnectAttempts = 0;
+        std::atomic<uint64_t> m_reconnects = 0;
+        std::atomic<uint64_t> m_connectToReadyNs = 0;
+        Clock::time_point m_connectStart{};
+        Histogram m_presenceAck;
+        Histogram m_commandLatency;
+    };
+}
+
+#endif // DISCORD_METRICS_HPP
@@ -0,0 +1,16 @@
+#pragma once
+#ifndef DISCORD_IO_BUFFER_HPP
+#define DISCORD_IO_BUFFER_HPP
+
+#include <cstddef>
+#include <discord-rpc/transport.hpp>
+
+namespace discord::platform {
+    using discord::IOBuffer;
+    using discord::Transport;
+
+    /// Maximum number of buffers a single vectored write takes
+    constexpr size_t MaxIOBuffers = 16;
+}
+
+#endif // DISCORD_IO_BUFFER_HPP
@@ -0,0 +1,366 @@
+#pragma once
+#ifndef DISCORD_IO_URING_HPP
+#define DISCORD_IO_URING_HPP
+
+#include "io-buffer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace discord::platform {
+    /// @brief Drives a connected socket through io_uring, using the raw syscalls so there's no liburing dependency.
+    ///
+    /// A receive into an internal buffer stays armed at all times. Writes are copied into a send buffer,
+    /// so a whole batch of frames (and the receive's re-arm) goes out with a single io_uring_enter.
+    /// The socket is registered as a fixed file. The ring's descriptor becomes readable whenever a
+    /// completion is waiting, which is what the IO worker waits on instead of the socket.
+    class IOUring {
+    public:
+        IOUring() noexcept = default;
+        ~IOUring() noexcept { detach(); }
+
+        IOUring(IOUring const&) = delete;
+        IOUring& operator=(IOUring const&) = delete;
+
+        /// Whether the kernel supports everything needed, probed once.
+        /// Only used when enabled with `RPCManager::setIOUring()`, setting `DISCORD_RPC_DISABLE_IO_URING`
+        /// in the environment turns it off even then.
+        static bool supported() noexcept {
+            static bool supported = [] {
+                if (::getenv("DISCORD_RPC_DISABLE_IO_URING")) {
+                    return false;
+                }
+
+                // NODROP and FAST_POLL (5.7) come after SEND/RECV (5.6), SINGLE_MMAP keeps the setup simple
+                io_uring_params params{};
+                int ring = setup(Entries, params);
+                if (ring < 0) {
+                    return false;
+                }
+                ::close(ring);
+
+                constexpr auto required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_FAST_POLL;
+                return (params.features & required) == required;
+            }();
+            return supported;
+        }
+
+        /// Takes over a connected socket, it's switched to blocking mode since only io_uring touches it
+        /// @return false if the ring couldn't be set up, the socket is left as it was
+        bool attach(int socket) noexcept {
+            if (!supported() || active()) {
+                return false;
+            }
+
+            io_uring_params params{};
+            m_ring = setup(Entries, params);
+            if (m_ring < 0 || !map(params)) {
+                detach();
+                return false;
+            }
+
+            if (::syscall(__NR_io_uring_register, m_ring, IORING_REGISTER_FILES, &socket, 1) != 0) {
+                detach();
+                return false;
+            }
+
+            if (!m_recvBuffer) { m_recvBuffer = std::make_unique<uint8_t[]>(RecvBufferSize); }
+            if (!m_sendBuffer) { m_sendBuffer = std::make_unique<uint8_t[]>(SendBufferSize); }
+
+            int flags = ::fcntl(socket, F_GETFL);
+            ::fcntl(socket, F_SETFL, flags & ~O_NONBLOCK);
+
+            m_recvStart = m_recvEnd = 0;
+            m_sendHead = m_sendTail = 0;
+            m_recvArmed = m_sendInFlight = false;
+            m_closed = false;
+            m_error = 0;
+
+            armReceive();
+            submit();
+            return true;
+        }
+
+        /// Tears down the ring, which cancels whatever is still in flight
+        void detach() noexcept {
+            if (m_sqes) {
+                ::munmap(m_sqes, m_sqesSize);
+                m_sqes = nullptr;
+            }
+            if (m_rings) {
+                ::munmap(m_rings, m_ringsSize);
+                m_rings = nullptr;
+            }
+            if (m_ring >= 0) {
+                ::close(m_ring);
+            }
+            m_ring = -1;
+            m_toSubmit = 0;
+        }
+
+        [[nodiscard]] bool active() const noexcept { return m_ring >= 0; }
+
+        /// Ring descriptor, readable while completions are waiting
+        [[nodiscard]] int handle() const noexcept { return m_ring; }
+
+        /// Whether the peer closed the connection or an operation failed (see error())
+        [[nodiscard]] bool closed() const noexcept { return m_closed; }
+
+        /// errno of the failed operation, 0 if the peer closed the connection
+        [[nodiscard]] int error() const noexcept { return m_error; }
+
+        /// Received bytes readSome() didn't hand out yet
+        [[nodiscard]] size_t buffered() const noexcept { return m_recvEnd - m_recvStart; }
+
+        /// Queues whole buffers while they fit into the send buffer, and submits them
+        /// @return Number of bytes taken, 0 if the send buffer is full or the connection was closed
+        size_t writeSome(std::span<IOBuffer const> buffers) noexcept {
+            reap(false);
+            if (m_closed) {
+                return 0;
+            }
+
+            size_t written = 0;
+            for (auto const& buffer : buffers) {
+                auto room = SendBufferSize - m_sendTail;
+                auto size = buffer.size;
+                if (size > room) {
+                    // only something bigger than the whole buffer is ever cut, so callers rarely see partial frames
+                    if (m_sendTail != 0 || written != 0) { break; }
+                    size = room;
+                }
+
+                std::memcpy(m_sendBuffer.get() + m_sendTail, buffer.data, size);
+                m_sendTail += size;
+                written += size;
+                if (size < buffer.size) { break; }
+            }
+
+            if (!m_sendInFlight && m_sendHead < m_sendTail) {
+                queueSend();
+            }
+            submit();
+            return written;
+        }
+
+        /// Copies out what the armed receive got, and re-arms it once everything was taken
+        /// @return Number of bytes read, 0 if nothing arrived yet or the connection was closed
+        size_t readSome(void* data, size_t capacity) noexcept {
+            reap();
+
+            size_t size = std::min(capacity, m_recvEnd - m_recvStart);
+            std::memcpy(data, m_recvBuffer.get() + m_recvStart, size);
+            m_recvStart += size;
+
+            if (m_recvStart == m_recvEnd && !m_recvArmed && !m_closed) {
+                m_recvStart = m_recvEnd = 0;
+                armReceive();
+            }
+            submit();
+            return size;
+        }
+
+    private:
+        static constexpr unsigned Entries = 8;
+        static constexpr size_t RecvBufferSize = 128 * 1024;
+        static constexpr size_t SendBufferSize = 256 * 1024;
+
+        enum Operation : uint64_t { Receive = 1, Send = 2 };
+
+        static int setup(unsigned entries, io_uring_params& params) noexcept {
+            return static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+        }
+
+        bool map(io_uring_params const& params) noexcept {
+            m_ringsSize = std::max(
+                params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe)
+            );
+            void* rings = ::mmap(nullptr, m_ringsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQ_RING);
+            if (rings == MAP_FAILED) {
+                return false;
+            }
+            m_rings = static_cast<uint8_t*>(rings);
+
+            m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+            void* sqes = ::mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring, IORING_OFF_SQES);
+            if (sqes == MAP_FAILED) {
+                return false;
+            }
+            m_sqes = static_cast<io_uring_sqe*>(sqes);
+
+            m_sqHead = reinterpret_cast<unsigned*>(m_rings + params.sq_off.head);
+            m_sqTail = reinterpret_cast<unsigned*>(m_rings + params.sq_off.tail);
+            m_sqMask = *reinterpret_cast<unsigned*>(m_rings + params.sq_off.ring_mask);
+            m_sqEntries = params.sq_entries;
+            m_cqHead = reinterpret_cast<unsigned*>(m_rings + params.cq_off.head);
+            m_cqTail = reinterpret_cast<unsigned*>(m_rings + params.cq_off.tail);
+            m_cqMask = *reinterpret_cast<unsigned*>(m_rings + params.cq_off.ring_mask);
+            m_cqes = reinterpret_cast<io_uring_cqe*>(m_rings + params.cq_off.cqes);
+
+            // submission entries always sit in the slot of the same index
+            auto* array = reinterpret_cast<unsigned*>(m_rings + params.sq_off.array);
+            for (unsigned i = 0; i < params.sq_entries; ++i) {
+                array[i] = i;
+            }
+            return true;
+        }
+
+        /// Next free submission entry, published by the following commit()
+        io_uring_sqe* prepare() noexcept {
+            auto tail = *m_sqTail;
+            auto head = std::atomic_ref(*m_sqHead).load(std::memory_order_acquire);
+            if (tail - head >= m_sqEntries) {
+                return nullptr;
+            }
+
+            auto* sqe = &m_sqes[tail & m_sqMask];
+            std::memset(sqe, 0, sizeof(*sqe));
+            sqe->fd = 0; // index of the registered socket
+            sqe->flags = IOSQE_FIXED_FILE;
+            return sqe;
+        }
+
+        void commit() noexcept {
+            std::atomic_ref(*m_sqTail).store(*m_sqTail + 1, std::memory_order_release);
+            ++m_toSubmit;
+        }
+
+        void armReceive() noexcept {
+            auto* sqe = prepare();
+            if (!sqe) { return; }
+
+            sqe->opcode = IORING_OP_RECV;
+            sqe->addr = reinterpret_cast<uint64_t>(m_recvBuffer.get());
+            sqe->len = RecvBufferSize;
+            sqe->user_data = Receive;
+            commit();
+            m_recvArmed = true;
+        }
+
+        void queueSend() noexcept {
+            auto* sqe = prepare();
+            if (!sqe) { return; }
+
+            sqe->opcode = IORING_OP_SEND;
+            sqe->addr = reinterpret_cast<uint64_t>(m_sendBuffer.get() + m_sendHead);
+            sqe->len = static_cast<uint32_t>(m_sendTail - m_sendHead);
+            sqe->msg_flags = MSG_NOSIGNAL;
+            sqe->user_data = Send;
+            commit();
+            m_sendInFlight = true;
+        }
+
+        /// Hands queued entries to the kernel without waiting for anything
+        void submit() noexcept {
+            if (m_toSubmit == 0) {
+                return;
+            }
+
+            auto submitted = ::syscall(__NR_io_uring_enter, m_ring, m_toSubmit, 0, 0, nullptr, 0);
+            if (submitted > 0) {
+                m_toSubmit -= static_cast<unsigned>(submitted);
+            } else if (submitted < 0 && errno != EAGAIN && errno != EBUSY && errno != EINTR) {
+                fail(errno);
+            }
+        }
+
+        /// Processes the completions that arrived so far
+        /// @param receives Whether to take a receive's completion, otherwise reaping stops in front of it.
+        /// A receive left in the queue keeps the ring's descriptor readable, so the IO worker comes back to read.
+        void reap(bool receives = true) noexcept {
+            auto head = *m_cqHead;
+            auto tail = std::atomic_ref(*m_cqTail).load(std::memory_order_acquire);
+            for (; head != tail; ++head) {
+                auto const& cqe = m_cqes[head & m_cqMask];
+                if (cqe.user_data == Receive) {
+                    if (!receives) { break; }
+                    completeReceive(cqe.res);
+                } else if (cqe.user_data == Send) {
+                    completeSend(cqe.res);
+                }
+            }
+            std::atomic_ref(*m_cqHead).store(head, std::memory_order_release);
+
+            if (!m_sendInFlight && !m_closed && m_sendHead < m_sendTail) {
+                queueSend();
+            }
+        }
+
+        void completeReceive(int result) noexcept {
+            m_recvArmed = false;
+            if (result > 0) {
+                m_recvStart = 0;
+                m_recvEnd = static_cast<size_t>(result);
+            } else if (result == 0) {
+                m_closed = true;
+            } else if (result != -EAGAIN && result != -EINTR && result != -ECANCELED) {
+                fail(-result);
+            }
+        }
+
+        void completeSend(int result) noexcept {
+            m_sendInFlight = false;
+            if (result > 0) {
+                m_sendHead += static_cast<size_t>(result);
+                if (m_sendHead == m_sendTail) {
+                    m_sendHead = m_sendTail = 0;
+                } else if (m_sendTail > SendBufferSize / 2) {
+                    // nothing is in flight now, make room at the end
+                    std::memmove(m_sendBuffer.get(), m_sendBuffer.get() + m_sendHead, m_sendTail - m_sendHead);
+                    m_sendTail -= m_sendHead;
+                    m_sendHead = 0;
+                }
+            } else if (result < 0 && result != -EAGAIN && result != -EINTR && result != -ECANCELED) {
+                fail(-result);
+            }
+        }
+
+        void fail(int error) noexcept {
+            m_closed = true;
+            m_error = error;
+        }
+
+        int m_ring = -1;
+        uint8_t* m_rings = nullptr;
+        size_t m_ringsSize = 0;
+        io_uring_sqe* m_sqes = nullptr;
+        size_t m_sqesSize = 0;
+
+        unsigned* m_sqHead = nullptr;
+        unsigned* m_sqTail = nullptr;
+        unsigned m_sqMask = 0;
+        unsigned m_sqEntries = 0;
+        unsigned* m_cqHead = nullptr;
+        unsigned* m_cqTail = nullptr;
+        unsigned m_cqMask = 0;
+        io_uring_cqe* m_cqes = nullptr;
+        unsigned m_toSubmit = 0; ///< Entries queued but not yet handed to the kernel
+
+        std::unique_ptr<uint8_t[]> m_recvBuffer;
+        size_t m_recvStart = 0; ///< Received bytes not yet read lie in [m_recvStart, m_recvEnd)
+        size_t m_recvEnd = 0;
+        bool m_recvArmed = false;
+
+        std::unique_ptr<uint8_t[]> m_sendBuffer;
+        size_t m_sendHead = 0; ///< Unsent bytes lie in [m_sendHead, m_sendTail), the front of them may be in flight
+        size_t m_sendTail = 0;
+        bool m_sendInFlight = false;
+
+        bool m_closed = false;
+        int m_error = 0;
+    };
+}
+
+#endif // DISCORD_IO_URING_HPP
@@ -0,0 +1,93 @@
+#pragma once
+#ifndef DISCORD_SOCKET_WATCHER_HPP
+#define DISCORD_SOCKET_WATCHER_HPP
+
+#include "unix.hpp"
+
+#include <string_view>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace discord::platform {
+    /// @brief Notices Discord's IPC socket appearing in one of the candidate directories, using inotify.
+    ///
+    /// Lets the IO worker connect as soon as Discord starts instead of when the reconnect backoff runs out.
+    /// Directories that don't exist yet (e.g. a Flatpak's) are picked up once their parent sees them created.
+    class SocketWatcher {
+    public:
+        SocketWatcher() noexcept = default;
+        ~SocketWatcher() noexcept { stop(); }
+
+        SocketWatcher(SocketWatcher const&) = delete;
+        SocketWatcher& operator=(SocketWatcher const&) = delete;
+
+        /// @return false if inotify isn't available, reconnects then only follow the backoff
+        bool start() noexcept {
+            m_inotify = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (m_inotify == -1) {
+                return false;
+            }
+
+            addWatches();
+            return true;
+        }
+
+        void stop() noexcept {
+            if (m_inotify != -1) {
+                ::close(m_inotify);
+                m_inotify = -1;
+            }
+        }
+
+        /// Descriptor that becomes readable when something is created in a watched directory, -1 if not started
+        [[nodiscard]] int handle() const noexcept { return m_inotify; }
+
+        /// Reads the pending notifications
+        /// @return true if a `discord-ipc-N` socket appeared
+        bool poll() noexcept {
+            bool appeared = false;
+            bool directories = false;
+
+            alignas(inotify_event) char buffer[4096];
+            ssize_t size;
+            while ((size = ::read(m_inotify, buffer, sizeof(buffer))) > 0) {
+                for (ssize_t offset = 0; offset < size;) {
+                    auto const* event = reinterpret_cast<inotify_event const*>(buffer + offset);
+                    offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+
+                    if (event->mask & IN_ISDIR) {
+                        directories = true;
+                    } else if (event->len > 0 && std::string_view(event->name).starts_with("discord-ipc-")) {
+                        appeared = true;
+                    }
+                }
+            }
+
+            if (directories) {
+                addWatches();
+            }
+            return appeared;
+        }
+
+    private:
+        /// Watches every candidate directory that exists, and the ones they could be created in.
+        /// Watching a directory twice is harmless, inotify hands back the same watch.
+        /// The temp directory fallback isn't watched itself, every file created there would wake up the client.
+        void addWatches() noexcept {
+            constexpr uint32_t mask = IN_CREATE | IN_MOVED_TO | IN_ONLYDIR;
+
+            auto const& paths = getCandidatePaths();
+            for (size_t i = usesTempFallback() ? 1 : 0; i < paths.size(); ++i) {
+                ::inotify_add_watch(m_inotify, paths[i].c_str(), mask);
+            }
+
+            // parent of the Flatpak directories
+            auto apps = fmt::format("{}/app", paths[0]);
+            ::inotify_add_watch(m_inotify, apps.c_str(), mask);
+        }
+
+        int m_inotify = -1;
+    };
+}
+
+#endif // DISCORD_SOCKET_WATCHER_HPP
@@ -1,5 +1,18 @@
 #pragma once
+#include "io-buffer.hpp"
+#include "../flight-recorder.hpp"
+#include "../tracing.hpp"
+
+#include <algorithm>
 #include <array>
+#include <charconv>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <dirent.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <fmt/format.h>
@@ -7,6 +20,11 @@
 #include <sys/types.h>
 #include <sys/un.h>
 
+#if defined(__linux__) && !defined(DISCORD_DISABLE_IO_URING) && __has_include(<linux/io_uring.h>)
+#define DISCORD_HAS_IO_URING
+#include "io-uring.hpp"
+#endif
+
 namespace discord::platform {
     inline size_t getProcessID() noexcept {
         return ::getpid();
@@ -23,16 +41,22 @@ namespace discord::platform {
         return path;
     }
 
+    /// Whether the candidate directories fall back to the temp directory, because there's no runtime directory
+    inline bool usesTempFallback() noexcept {
+        static bool fallback = !::getenv("XDG_RUNTIME_DIR")
+            && ::access(fmt::format("/run/user/{}", ::getuid()).c_str(), F_OK) != 0;
+        return fallback;
+    }
+
     inline std::array<std::string, 4> const& getCandidatePaths() {
         static std::array<std::string, 4> paths = []() {
-            char const* base = ::getenv("XDG_RUNTIME_DIR");
-            if (!base) {
-                auto runUser = fmt::format("/run/user/{}", ::getuid());
-                if (::access(runUser.c_str(), F_OK) == 0) {
-                    base = runUser.c_str();
-                } else {
-                    base = getTempPath();
-                }
+            std::string base;
+            if (char const* runtime = ::getenv("XDG_RUNTIME_DIR")) {
+                base = runtime;
+            } else if (!usesTempFallback()) {
+                base = fmt::format("/run/user/{}", ::getuid());
+            } else {
+                base = getTempPath();
             }
 
             std::array<std::string, 4> result = {
@@ -47,10 +71,52 @@ namespace discord::platform {
         return paths;
     }
 
-    class PipeConnection {
-        PipeConnection() noexcept {
-            m_address.sun_family = AF_UNIX;
+    /// Discord's IPC sockets that exist right now, found by listing the candidate directories
+    /// instead of trying every possible path. `preferred` (the last one that worked) comes first,
+    /// the rest are ranked like Discord's own SDK tries them: by directory, then by pipe number.
+    inline std::vector<std::string> findSockets(std::string_view preferred) {
+        constexpr std::string_view prefix = "discord-ipc-";
+
+        std::vector<std::pair<int, std::string>> found;
+        auto const& dirs = getCandidatePaths();
+        for (size_t i = 0; i < dirs.size(); ++i) {
+            DIR* dir = ::opendir(dirs[i].c_str());
+            if (!dir) {
+                continue;
+            }
+
+            while (auto const* entry = ::readdir(dir)) {
+                std::string_view name = entry->d_name;
+                if (!name.starts_with(prefix) || (entry->d_type != DT_SOCK && entry->d_type != DT_UNKNOWN)) {
+                    continue;
+                }
+
+                int pipe = -1;
+                auto digits = name.substr(prefix.size());
+                auto [end, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), pipe);
+                if (ec != std::errc{} || end != digits.data() + digits.size() || pipe < 0 || pipe > 9) {
+                    continue;
+                }
+
+                auto path = fmt::format("{}/{}", dirs[i], name);
+                int rank = path == preferred ? -1 : static_cast<int>(i) * 10 + pipe;
+                found.emplace_back(rank, std::move(path));
+            }
+            ::closedir(dir);
+        }
+
+        std::sort(found.begin(), found.end());
+
+        std::vector<std::string> paths;
+        paths.reserve(found.size());
+        for (auto& [rank, path] : found) {
+            paths.push_back(std::move(path));
         }
+        return paths;
+    }
+
+    class PipeConnection final : public Transport {
+        PipeConnection() noexcept = default;
 
     public:
         static PipeConnection& get() noexcept {
@@ -58,96 +124,203 @@ namespace discord::platform {
             return instance;
         }
 
-        bool open() noexcept {
-            if (m_isOpen || m_socket != -1) {
-                return false;
-            }
+        #ifdef DISCORD_HAS_IO_URING
+        /// Lets the next connection be driven by io_uring where the kernel supports it, off by default
+        void setIOUring(bool enabled) noexcept { m_useIOUring.store(enabled, std::memory_order_relaxed); }
+        #endif
 
-            m_socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
-            if (m_socket == -1) {
+        /// Connects to the first socket that takes the connection, the one that worked last time is tried first
+        bool open() noexcept override {
+            if (m_isOpen || m_socket != -1) {
                 return false;
             }
 
-            ::fcntl(m_socket, F_SETFL, O_NONBLOCK);
-            #ifdef SO_NOSIGPIPE
-            int optval = 1;
-            ::setsockopt(m_socket, SOL_SOCKET, SO_NOSIGPIPE, &optval, sizeof(optval));
-            #endif
-
-            for (auto& dir : getCandidatePaths()) {
-                for (int i = 0; i < 10; ++i) {
-                    fmt::format_to(m_address.sun_path, "{}/discord-ipc-{}", dir, i);
-                    if (::connect(m_socket, reinterpret_cast<sockaddr*>(&m_address), sizeof(m_address)) == 0) {
-                        m_isOpen = true;
-                        return true;
+            for (auto const& path : findSockets(m_lastPath)) {
+                if (connect(path)) {
+                    #ifdef DISCORD_HAS_IO_URING
+                    if (m_useIOUring.load(std::memory_order_relaxed)) {
+                        m_uring.attach(m_socket);
                     }
+                    #endif
+                    m_lastPath = path;
+                    m_isOpen = true;
+                    return true;
                 }
             }
 
-            m_socket = -1;
             return false;
         }
 
-        bool close() noexcept {
+        bool close() noexcept override {
             if (!m_isOpen || m_socket == -1) {
                 return false;
             }
 
+            #ifdef DISCORD_HAS_IO_URING
+            m_uring.detach();
+            #endif
             ::close(m_socket);
             m_socket = -1;
             m_isOpen = false;
             return true;
         }
 
-        [[nodiscard]] bool isOpen() const noexcept {
+        [[nodiscard]] bool isOpen() const noexcept override {
             return m_isOpen;
         }
 
-        bool write(void const* data, size_t length) noexcept {
+        /// Socket descriptor for readiness notifications (the io_uring's while it drives the socket), -1 if closed
+        [[nodiscard]] int handle() const noexcept override {
+            #ifdef DISCORD_HAS_IO_URING
+            if (m_uring.active()) {
+                return m_uring.handle();
+            }
+            #endif
+            return m_socket;
+        }
+
+        /// The io_uring's descriptor only signals completions, which is also when a full send buffer has room again
+        [[nodiscard]] bool pollsWritable() const noexcept override {
+            #ifdef DISCORD_HAS_IO_URING
+            return !m_uring.active();
+            #else
+            return true;
+            #endif
+        }
+
+        /// Writes as much of the buffers as the socket takes in one syscall
+        /// @return Number of bytes written, 0 if the socket is full or was closed (see isOpen())
+        size_t writeSome(std::span<IOBuffer const> buffers) noexcept override {
+            DISCORD_TRACE_ZONE("PipeConnection::write");
             if (!m_isOpen || m_socket == -1) {
-                return false;
+                return 0;
             }
 
-            ssize_t written = ::send(m_socket, data, length, MSG_FLAGS);
+            #ifdef DISCORD_HAS_IO_URING
+            if (m_uring.active()) {
+                auto written = m_uring.writeSome(buffers);
+                checkRing();
+                return written;
+            }
+            #endif
+
+            std::array<iovec, MaxIOBuffers> iov;
+            size_t count = std::min(buffers.size(), MaxIOBuffers);
+            for (size_t i = 0; i < count; ++i) {
+                iov[i].iov_base = const_cast<void*>(buffers[i].data);
+                iov[i].iov_len = buffers[i].size;
+            }
+
+            msghdr msg{};
+            msg.msg_iov = iov.data();
+            msg.msg_iovlen = count;
+
+            ssize_t written = ::sendmsg(m_socket, &msg, MSG_FLAGS);
             if (written < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                    return 0;
+                }
+
+                FlightRecorder::get().record(ProtocolEvent::Kind::Error, 0, 0, 0, 0, errno);
                 this->close();
-                return false;
+                return 0;
             }
 
-            return static_cast<size_t>(written) == length;
+            return static_cast<size_t>(written);
         }
 
-        bool read(void* data, size_t length) noexcept {
+        /// Reads as many bytes as are available, up to `capacity`
+        /// @return Number of bytes read, 0 if nothing is available or the pipe was closed (see isOpen())
+        size_t readSome(void* data, size_t capacity) noexcept override {
+            DISCORD_TRACE_ZONE("PipeConnection::read");
             if (!m_isOpen || m_socket == -1) {
-                return false;
+                return 0;
+            }
+
+            #ifdef DISCORD_HAS_IO_URING
+            if (m_uring.active()) {
+                auto received = m_uring.readSome(data, capacity);
+                checkRing();
+                return received;
             }
+            #endif
 
-            ssize_t received = ::recv(m_socket, data, length, MSG_FLAGS);
+            ssize_t received = ::recv(m_socket, data, capacity, MSG_FLAGS);
             if (received < 0) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                    return false;
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+                    return 0;
                 }
 
+                FlightRecorder::get().record(ProtocolEvent::Kind::Error, 0, 0, 0, 0, errno);
                 this->close();
-                return false;
+                return 0;
             }
 
             if (received == 0) {
                 this->close();
-                return false;
+                return 0;
             }
 
-            return static_cast<size_t>(received) == length;
+            return static_cast<size_t>(received);
         }
 
     private:
+        /// Connects a fresh socket to the path, a socket whose connect failed isn't reused
+        bool connect(std::string const& path) noexcept {
+            sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+            if (path.size() >= sizeof(address.sun_path)) {
+                return false;
+            }
+            std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+            int socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if (socket == -1) {
+                return false;
+            }
+
+            ::fcntl(socket, F_SETFD, FD_CLOEXEC);
+            ::fcntl(socket, F_SETFL, O_NONBLOCK);
+            #ifdef SO_NOSIGPIPE
+            int optval = 1;
+            ::setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &optval, sizeof(optval));
+            #endif
+
+            if (::connect(socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+                ::close(socket);
+                return false;
+            }
+
+            m_socket = socket;
+            return true;
+        }
+
+        #ifdef DISCORD_HAS_IO_URING
+        /// Closes the connection once the ring saw it end, data that arrived before an orderly close is read first
+        void checkRing() noexcept {
+            if (!m_uring.closed()) {
+                return;
+            }
+
+            if (m_uring.error() != 0) {
+                FlightRecorder::get().record(ProtocolEvent::Kind::Error, 0, 0, 0, 0, m_uring.error());
+                this->close();
+            } else if (m_uring.buffered() == 0) {
+                this->close();
+            }
+        }
+
+        IOUring m_uring;
+        std::atomic_bool m_useIOUring = false;
+        #endif
+
         #ifdef MSG_NOSIGNAL
         static constexpr int MSG_FLAGS = MSG_NOSIGNAL;
         #else
         static constexpr int MSG_FLAGS = 0;
         #endif
 
-        sockaddr_un m_address{};
+        std::string m_lastPath; ///< Socket of the last successful connection
         int m_socket = -1;
         bool m_isOpen = false;
     };
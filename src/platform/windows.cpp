@@ -1,4 +1,7 @@
 #include "windows.hpp"
+#include "../flight-recorder.hpp"
+#include "../tracing.hpp"
+#include <algorithm>
 #include <array>
 #include <WinSock2.h>
 #include <fmt/format.h>
@@ -174,60 +177,74 @@ namespace discord::platform {
         return true;
     }
 
-    bool PipeConnection::write(void const* data, size_t length) const noexcept {
-        if (length == 0) {
-            return true;
-        }
-
+    size_t PipeConnection::writeSome(std::span<IOBuffer const> buffers) noexcept {
+        DISCORD_TRACE_ZONE("PipeConnection::write");
         if (m_useWineFallback) {
-            return writeUnix(data, length);
+            return writeSomeUnix(buffers);
         }
 
         if (m_pipe == INVALID_HANDLE_VALUE) {
-            return false;
+            return 0;
         }
 
-        if (!data) {
-            return false;
-        }
+        // named pipes have no gather write, the pipe is blocking so each write completes
+        size_t total = 0;
+        for (auto const& buffer : buffers) {
+            if (buffer.size == 0) {
+                continue;
+            }
 
-        auto const bytesToWrite = static_cast<DWORD>(length);
-        DWORD bytesWritten = 0;
-        if (!::WriteFile(m_pipe, data, bytesToWrite, &bytesWritten, nullptr)) {
-            return false;
+            auto const bytesToWrite = static_cast<DWORD>(buffer.size);
+            DWORD bytesWritten = 0;
+            if (!::WriteFile(m_pipe, buffer.data, bytesToWrite, &bytesWritten, nullptr)) {
+                FlightRecorder::get().record(ProtocolEvent::Kind::Error, 0, 0, 0, 0, static_cast<int32_t>(::GetLastError()));
+                this->close();
+                return total;
+            }
+
+            total += bytesWritten;
+            if (bytesWritten != bytesToWrite) {
+                break;
+            }
         }
-        return bytesWritten == bytesToWrite;
+
+        return total;
     }
 
-    bool PipeConnection::read(void* data, size_t length) noexcept {
-        if (!data) {
-            return false;
+    size_t PipeConnection::readSome(void* data, size_t capacity) noexcept {
+        DISCORD_TRACE_ZONE("PipeConnection::read");
+        if (!data || capacity == 0) {
+            return 0;
         }
 
         if (m_useWineFallback) {
-            return readUnix(data, length);
+            return readSomeUnix(data, capacity);
         }
 
         if (m_pipe == INVALID_HANDLE_VALUE) {
-            return false;
+            return 0;
         }
 
-        DWORD bytesRead = 0;
-        if (!::PeekNamedPipe(m_pipe, nullptr, 0, nullptr, &bytesRead, nullptr)) {
+        DWORD available = 0;
+        if (!::PeekNamedPipe(m_pipe, nullptr, 0, nullptr, &available, nullptr)) {
+            FlightRecorder::get().record(ProtocolEvent::Kind::Error, 0, 0, 0, 0, static_cast<int32_t>(::GetLastError()));
             this->close();
-            return false;
+            return 0;
         }
 
-        if (bytesRead < length) {
-            return false;
+        if (available == 0) {
+            return 0;
         }
 
-        if (!::ReadFile(m_pipe, data, length, &bytesRead, nullptr)) {
+        DWORD bytesRead = 0;
+        auto toRead = static_cast<DWORD>(std::min<size_t>(available, capacity));
+        if (!::ReadFile(m_pipe, data, toRead, &bytesRead, nullptr)) {
+            FlightRecorder::get().record(ProtocolEvent::Kind::Error, 0, 0, 0, 0, static_cast<int32_t>(::GetLastError()));
             this->close();
-            return false;
+            return 0;
         }
 
-        return true;
+        return bytesRead;
     }
 
     bool PipeConnection::openUnix() noexcept {
@@ -288,39 +305,51 @@ namespace discord::platform {
         return true;
     }
 
-    bool PipeConnection::writeUnix(void const* data, size_t length) const noexcept {
-        if (!data) {
-            return true;
-        }
-
+    size_t PipeConnection::writeSomeUnix(std::span<IOBuffer const> buffers) noexcept {
         auto socket = reinterpret_cast<SOCKET>(m_pipe);
         if (socket == INVALID_SOCKET) {
-            return false;
+            return 0;
         }
 
-        int bytesSent = ::send(socket, static_cast<char const*>(data), static_cast<int>(length), 0);
-        if (bytesSent == SOCKET_ERROR) {
-            return false;
+        std::array<WSABUF, MaxIOBuffers> wsaBuffers;
+        auto count = std::min(buffers.size(), MaxIOBuffers);
+        for (size_t i = 0; i < count; ++i) {
+            wsaBuffers[i].buf = static_cast<char*>(const_cast<void*>(buffers[i].data));
+            wsaBuffers[i].len = static_cast<ULONG>(buffers[i].size);
         }
 
-        return bytesSent == static_cast<int>(length);
-    }
-
-    bool PipeConnection::readUnix(void* data, size_t length) noexcept {
-        if (length == 0) {
-            return true;
+        DWORD bytesSent = 0;
+        if (::WSASend(socket, wsaBuffers.data(), static_cast<DWORD>(count), &bytesSent, 0, nullptr, nullptr) == SOCKET_ERROR) {
+            if (auto error = ::WSAGetLastError(); error != WSAEWOULDBLOCK) {
+                FlightRecorder::get().record(ProtocolEvent::Kind::Error, 0, 0, 0, 0, error);
+                closeUnix();
+            }
+            return 0;
         }
 
+        return bytesSent;
+    }
+
+    size_t PipeConnection::readSomeUnix(void* data, size_t capacity) noexcept {
         auto socket = reinterpret_cast<SOCKET>(m_pipe);
         if (socket == INVALID_SOCKET) {
-            return false;
+            return 0;
         }
 
-        int bytesRead = ::recv(socket, static_cast<char*>(data), static_cast<int>(length), 0);
+        int bytesRead = ::recv(socket, static_cast<char*>(data), static_cast<int>(capacity), 0);
         if (bytesRead == SOCKET_ERROR) {
-            return false;
+            if (auto error = ::WSAGetLastError(); error != WSAEWOULDBLOCK) {
+                FlightRecorder::get().record(ProtocolEvent::Kind::Error, 0, 0, 0, 0, error);
+                closeUnix();
+            }
+            return 0;
+        }
+
+        if (bytesRead == 0) {
+            closeUnix();
+            return 0;
         }
 
-        return bytesRead == static_cast<int>(length);
+        return static_cast<size_t>(bytesRead);
     }
 }
@@ -8,32 +8,40 @@
 #define NOIME
 #define NOMINMAX
 #include <cstdint>
+#include <span>
 #include <Windows.h>
 
+#include "io-buffer.hpp"
+
 namespace discord::platform {
     size_t getProcessID() noexcept;
 
-    class PipeConnection {
+    class PipeConnection final : public Transport {
         PipeConnection() noexcept;
         ~PipeConnection() noexcept;
 
     public:
         static PipeConnection& get() noexcept;
 
-        bool open() noexcept;
-        bool close() noexcept;
+        bool open() noexcept override;
+        bool close() noexcept override;
+
+        /// Writes as much of the buffers as the pipe takes
+        /// @return Number of bytes written, 0 if the pipe is full or was closed (see isOpen())
+        size_t writeSome(std::span<IOBuffer const> buffers) noexcept override;
 
-        bool write(void const* data, size_t length) const noexcept;
-        bool read(void* data, size_t length) noexcept;
+        /// Reads as many bytes as are available, up to `capacity`
+        /// @return Number of bytes read, 0 if nothing is available or the pipe was closed (see isOpen())
+        size_t readSome(void* data, size_t capacity) noexcept override;
 
-        [[nodiscard]] bool isOpen() const noexcept { return m_isOpen; }
+        [[nodiscard]] bool isOpen() const noexcept override { return m_isOpen; }
 
     private:
         // Unix methods for Wine compatibility
         bool openUnix() noexcept;
         bool closeUnix() noexcept;
-        bool writeUnix(void const* data, size_t length) const noexcept;
-        bool readUnix(void* data, size_t length) noexcept;
+        size_t writeSomeUnix(std::span<IOBuffer const> buffers) noexcept;
+        size_t readSomeUnix(void* data, size_t capacity) noexcept;
 
         HANDLE m_pipe = INVALID_HANDLE_VALUE;
         bool m_isOpen = false;
@@ -0,0 +1,59 @@
+#include <discord-rpc/reconnect-policy.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace discord {
+    ReconnectPolicy::ReconnectPolicy(ReconnectOptions const& options) noexcept {
+        configure(options);
+    }
+
+    void ReconnectPolicy::configure(ReconnectOptions const& options) noexcept {
+        std::lock_guard lock(m_mutex);
+        m_options = options;
+        m_options.initialDelay = std::max(m_options.initialDelay, std::chrono::milliseconds(1));
+        m_options.maxDelay = std::max(m_options.maxDelay, m_options.initialDelay);
+        m_options.jitter = std::clamp(m_options.jitter, 0.0, 1.0);
+        m_delay = {};
+    }
+
+    ReconnectPolicy::Clock::duration ReconnectPolicy::attempt(Clock::time_point now) noexcept {
+        std::lock_guard lock(m_mutex);
+        auto attempts = m_attempts.fetch_add(1, std::memory_order_relaxed) + 1;
+
+        using Duration = std::chrono::duration<double, Clock::period>;
+        Duration initial = m_options.initialDelay;
+        Duration max = m_options.maxDelay;
+        std::uniform_real_distribution<> random(0.0, 1.0);
+
+        Duration delay;
+        switch (m_options.strategy) {
+            case ReconnectStrategy::CappedExponential: {
+                auto exponent = std::min<uint32_t>(attempts - 1, 62);
+                auto ceiling = std::min(max, initial * std::ldexp(1.0, static_cast<int>(exponent)));
+                delay = std::max(initial, ceiling * (1.0 - m_options.jitter * random(m_generator)));
+            } break;
+            case ReconnectStrategy::DecorrelatedJitter:
+            default: {
+                Duration previous = m_delay == Clock::duration{} ? initial : Duration(m_delay);
+                auto upper = std::max(initial, previous * 3.0);
+                delay = std::min(max, initial + (upper - initial) * random(m_generator));
+            } break;
+        }
+
+        m_delay = std::chrono::duration_cast<Clock::duration>(delay);
+        m_nextAttempt.store((now + m_delay).time_since_epoch().count(), std::memory_order_relaxed);
+        return m_delay;
+    }
+
+    void ReconnectPolicy::reset() noexcept {
+        std::lock_guard lock(m_mutex);
+        m_delay = {};
+        m_attempts.store(0, std::memory_order_relaxed);
+        m_nextAttempt.store(Immediately, std::memory_order_relaxed);
+    }
+
+    void ReconnectPolicy::expedite(std::optional<Clock::time_point> at) noexcept {
+        m_nextAttempt.store(at ? at->time_since_epoch().count() : Immediately, std::memory_order_relaxed);
+    }
+}
@@ -2,10 +2,17 @@
 #ifndef DISCORD_RPC_CONNECTION_HPP
 #define DISCORD_RPC_CONNECTION_HPP
 
+#include "flight-recorder.hpp"
+#include "metrics.hpp"
 #include "serialization.hpp"
+#include "tracing.hpp"
 #include "platform/platform.hpp"
 
+#include <array>
+#include <cstring>
+#include <span>
 #include <string>
+#include <vector>
 #include <fmt/format.h>
 
 namespace discord {
@@ -22,11 +29,38 @@ namespace discord {
         std::string message;
     };
 
+    /// Envelope of every frame Discord sends after the handshake, `data` is parsed once `evt` is known.
+    /// Strings are views into the receive buffer (JSON escapes are left as is).
+    struct EventPacket {
+        std::optional<std::string_view> cmd;
+        std::optional<std::string_view> evt;
+        std::optional<std::string_view> nonce;
+        glz::raw_json_view data;
+    };
+
+    /// Data of an ERROR response
+    struct ErrorEvent {
+        int code = 0;
+        std::string_view message;
+    };
+
+    /// ACTIVITY_JOIN and ACTIVITY_SPECTATE
+    struct SecretEvent {
+        std::string_view secret;
+    };
+
+    /// ACTIVITY_JOIN_REQUEST
+    struct JoinRequestEvent {
+        User user;
+    };
+
     enum class ErrorCode : int32_t {
         Unknown     = -1,
         Success     = 0,
         PipeClosed  = 1,
         ReadCorrupt = 2,
+        HandshakeTimeout = 3,
+        CommandTooLarge  = 4,
     };
 
     constexpr ErrorCode toErr(int32_t v) noexcept { return static_cast<ErrorCode>(v); }
@@ -83,11 +117,40 @@ namespace discord {
             void setMessage(Opcode opcode, std::string_view data) noexcept {
                 return this->setMessage(opcode, data.size(), reinterpret_cast<uint8_t const*>(data.data()));
             }
+
+            /// Reads the header at the start of a received frame
+            static void readHeader(void const* src, Opcode& opcode, uint32_t& length) noexcept {
+                std::memcpy(&opcode, src, sizeof(opcode));
+                std::memcpy(&length, static_cast<uint8_t const*>(src) + sizeof(opcode), sizeof(length));
+            }
+
+            /// Fills the header of a frame that was serialized in place (see `FrameHeaderSize`)
+            static void writeHeader(void* dst, Opcode opcode, size_t length) noexcept {
+                auto len = static_cast<uint32_t>(length);
+                std::memcpy(dst, &opcode, sizeof(opcode));
+                std::memcpy(static_cast<uint8_t*>(dst) + sizeof(opcode), &len, sizeof(len));
+            }
         };
 
+        static_assert(MessageFrame::HeaderSize == FrameHeaderSize, "serializers must reserve room for the frame header");
+
+        /// Whether a command serialized with room for the header (see `FrameHeaderSize`) goes out as one frame.
+        /// One that doesn't can never be sent, it's counted and recorded for the diagnostics.
+        static bool fitsInFrame(std::string_view command, int32_t nonce) noexcept {
+            if (command.size() >= MessageFrame::HeaderSize && command.size() <= MessageFrame::MaxSize) {
+                return true;
+            }
+
+            Metrics::get().commandRejected();
+            FlightRecorder::get().record(ProtocolEvent::Kind::Error, 0, 0, command.size(), nonce, toInt(ErrorCode::CommandTooLarge));
+            return false;
+        }
+
         [[nodiscard]] bool isOpen() const { return m_state == State::Connected; }
+        [[nodiscard]] bool isDisconnected() const { return m_state == State::Disconnected; }
 
         void sendError() const {
+            FlightRecorder::get().record(ProtocolEvent::Kind::Error, 0, uint8_t(m_state), 0, 0, toInt(m_lastError));
             RPCManager::get().invokeOnErrored(toInt(m_lastError), m_lastErrorMessage);
         }
 
@@ -96,35 +159,50 @@ namespace discord {
                 return;
             }
 
-            if (m_state == State::Disconnected && !platform::PipeConnection::get().open()) {
-                return;
+            DISCORD_TRACE_ZONE("handshake");
+
+            if (m_state == State::Disconnected) {
+                // a new transport only takes over between connections
+                m_transport = m_requestedTransport.load();
+                if (!m_transport->open()) {
+                    return;
+                }
+                ++m_generation;
             }
 
             if (m_state == State::SentHandshake) {
-                std::string buffer;
-                if (!this->read(buffer)) {
+                // the rest of a handshake the pipe only took part of, write() isn't reached before READY
+                if (!this->flush()) {
+                    if (!m_transport->isOpen()) { this->close(); }
                     return;
                 }
 
+                std::string_view payload;
+                if (!this->read(payload)) {
+                    return;
+                }
+
+                // glaze expects a null-terminated buffer
+                std::string buffer(payload);
                 HandshakeResponse packet;
                 if (glz::read<glz::opts{.error_on_unknown_keys = false}>(packet, buffer)) {
                     m_lastError = ErrorCode::ReadCorrupt;
                     m_lastErrorMessage = "Failed to read handshake response";
-                    this->close();
                     sendError();
+                    this->close();
                     return;
                 }
 
                 if (packet.cmd != "DISPATCH" || packet.evt != "READY") {
                     m_lastError = ErrorCode::ReadCorrupt;
                     m_lastErrorMessage = "Unexpected handshake response";
-                    this->close();
                     sendError();
+                    this->close();
                     return;
                 }
 
-                m_state = State::Connected;
-                RPCManager::get().invokeOnReady(packet.toUser());
+                this->setState(State::Connected);
+                RPCManager::get().handleReady(packet.toUser());
                 return;
             }
 
@@ -134,76 +212,162 @@ namespace discord {
                 1, appID
             );
 
-            if (platform::PipeConnection::get().write(m_frame.get(), m_frame->size())) {
-                m_state = State::SentHandshake;
+            if (this->writeRaw(m_frame.get(), m_frame->size())) {
+                this->setState(State::SentHandshake);
             } else {
                 this->close();
             }
         }
 
         void close() {
+            bool wasOpen = m_state != State::Disconnected;
+            RPCManager::get().handleClosed(m_lastErrorMessage.empty() ? "Connection closed" : m_lastErrorMessage);
             RPCManager::get().invokeOnDisconnected(toInt(m_lastError), m_lastErrorMessage);
-            platform::PipeConnection::get().close();
-            m_state = State::Disconnected;
+            m_transport->close();
+            m_transport = m_requestedTransport.load();
+            this->setState(State::Disconnected);
+            m_readStart = m_readEnd = 0;
+            m_pendingOutput.clear();
+            m_pendingFrames.clear();
+
+            // whatever led up to the disconnect is what a bug report needs
+            if (wasOpen) {
+                RPCManager::get().reportDiagnostics();
+            }
         }
 
-        bool write(std::string_view buffer) {
+        /// Sends commands serialized with room for the header in front of them (see `FrameHeaderSize`).
+        /// Headers are filled in place and up to `platform::MaxIOBuffers` frames go out in one syscall.
+        /// A frame the pipe only took part of is finished from the pending output later, so it counts as sent.
+        /// When the pipe is full, the rest is left for when it becomes writable again.
+        /// @return Number of leading commands that don't need to be written again
+        size_t write(std::span<CommandQueue::Entry> frames) {
             if (m_state != State::Connected) {
-                return false;
+                return 0;
             }
 
-            m_frame->setMessage(Opcode::Frame, buffer);
+            auto& conn = *m_transport;
+            if (!this->flush()) {
+                if (!conn.isOpen()) { this->close(); }
+                return 0;
+            }
 
-            if (!platform::PipeConnection::get().write(m_frame.get(), m_frame->size())) {
-                this->close();
-                return false;
+            size_t done = 0;
+            while (done < frames.size()) {
+                std::array<platform::IOBuffer, platform::MaxIOBuffers> buffers;
+                size_t count = 0;
+                for (size_t i = done; i < frames.size() && count < buffers.size(); ++i) {
+                    auto& frame = frames[i].command;
+                    if (frame.size() < MessageFrame::HeaderSize || frame.size() > MessageFrame::MaxSize) {
+                        // rejected on submit (see fitsInFrame()), requeueing wouldn't help anyway
+                        buffers[count++] = {frame.data(), 0};
+                        continue;
+                    }
+
+                    MessageFrame::writeHeader(frame.data(), Opcode::Frame, frame.size() - MessageFrame::HeaderSize);
+                    buffers[count++] = {frame.data(), frame.size()};
+                }
+
+                auto written = conn.writeSome({buffers.data(), count});
+                if (!conn.isOpen()) {
+                    this->close();
+                    return done;
+                }
+
+                auto bytes = written;
+                size_t sent = 0;
+                while (sent < count && written >= buffers[sent].size) {
+                    written -= buffers[sent].size;
+                    ++sent;
+                }
+
+                // a frame only counts once its last byte is out
+                Metrics::get().frameSent(bytes, 0);
+                for (size_t i = 0; i < sent; ++i) {
+                    if (buffers[i].size >= MessageFrame::HeaderSize) {
+                        this->frameWritten(pendingFrame(buffers[i], buffers[i].size));
+                    }
+                }
+
+                if (sent < count && written > 0) {
+                    // keep the rest of the frame that was cut off, nothing else may go out before it
+                    auto const* rest = static_cast<char const*>(buffers[sent].data) + written;
+                    m_pendingOutput.assign(rest, buffers[sent].size - written);
+                    m_pendingFrames.push_back(pendingFrame(buffers[sent], m_pendingOutput.size()));
+                    return done + sent + 1;
+                }
+
+                done += sent;
+                if (sent < count) {
+                    // the pipe is full
+                    break;
+                }
             }
 
-            return true;
+            return done;
         }
 
+        /// Whether there's output waiting for the pipe to become writable
+        [[nodiscard]] bool wantsWrite() const noexcept { return !m_pendingOutput.empty(); }
+
         [[nodiscard]] ErrorCode lastError() const noexcept { return m_lastError; }
         [[nodiscard]] std::string const& lastErrorMessage() const noexcept { return m_lastErrorMessage; }
 
-        bool read(std::string& buffer) {
+        /// Returns the payload of the next data frame, handling PING/PONG/CLOSE on the way.
+        /// Frames are parsed out of a receive buffer that is filled with as many bytes as are
+        /// available per syscall, partial frames are kept until the rest arrives.
+        /// @note The payload points into the receive buffer and is valid until the next read.
+        bool read(std::string_view& payload) {
             if (m_state != State::Connected && m_state != State::SentHandshake) {
                 return false;
             }
 
-            auto& conn = platform::PipeConnection::get();
             do {
-                // Read header
-                bool success = conn.read(m_frame.get(), MessageFrame::HeaderSize);
-                if (!success) {
-                    if (!conn.isOpen()) {
-                        m_lastError = ErrorCode::PipeClosed;
-                        m_lastErrorMessage = "Pipe closed";
-                        this->close();
-                        sendError();
+                auto available = m_readEnd - m_readStart;
+                if (available < MessageFrame::HeaderSize) {
+                    if (!this->fill()) {
+                        return false;
                     }
+                    continue;
+                }
+
+                auto* frame = m_readBuffer.get() + m_readStart;
+                Opcode opcode;
+                uint32_t length;
+                MessageFrame::readHeader(frame, opcode, length);
+
+                if (length > MessageFrame::MaxDataSize) {
+                    m_lastError = ErrorCode::ReadCorrupt;
+                    m_lastErrorMessage = "Frame too large";
+                    sendError();
+                    this->close();
                     return false;
                 }
 
-                // Read data
-                if (m_frame->length > 0) {
-                    success = conn.read(m_frame->data, m_frame->length);
-                    if (!success) {
-                        m_lastError = ErrorCode::ReadCorrupt;
-                        m_lastErrorMessage = "Partial data in frame";
-                        this->close();
-                        sendError();
+                auto frameSize = MessageFrame::HeaderSize + length;
+                if (available < frameSize) {
+                    if (!this->fill()) {
                         return false;
                     }
-                    m_frame->data[m_frame->length] = '\0';
+                    continue;
                 }
 
-                switch (m_frame->opcode) {
+                m_readStart += frameSize;
+                Metrics::get().frameReceived();
+                std::string_view data(reinterpret_cast<char const*>(frame + MessageFrame::HeaderSize), length);
+                FlightRecorder::get().record(
+                    ProtocolEvent::Kind::Received, uint8_t(opcode), uint8_t(m_state),
+                    length, FlightRecorder::findNonce(data)
+                );
+
+                switch (opcode) {
                     case Opcode::Frame: {
-                        buffer.assign(reinterpret_cast<char*>(m_frame->data), m_frame->length);
+                        payload = data;
                         return true;
                     }
                     case Opcode::Close: {
-                        buffer.assign(reinterpret_cast<char*>(m_frame->data), m_frame->length);
+                        // glaze expects a null-terminated buffer
+                        std::string buffer(data);
                         ClosePacket packet;
                         if (glz::read<glz::opts{.error_on_unknown_keys = false}>(packet, buffer)) {
                             m_lastError = ErrorCode::ReadCorrupt;
@@ -218,8 +382,9 @@ namespace discord {
                         return false;
                     }
                     case Opcode::Ping: {
-                        m_frame->opcode = Opcode::Pong;
-                        if (!conn.write(m_frame.get(), m_frame->size())) {
+                        // answer in place, the frame is still intact in the receive buffer
+                        MessageFrame::writeHeader(frame, Opcode::Pong, length);
+                        if (!this->writeRaw(frame, frameSize)) {
                             this->close();
                             return false;
                         }
@@ -229,8 +394,8 @@ namespace discord {
                     default: {
                         m_lastError = ErrorCode::ReadCorrupt;
                         m_lastErrorMessage = "Bad IPC opcode";
-                        this->close();
                         sendError();
+                        this->close();
                         return false;
                     }
                 }
@@ -239,9 +404,151 @@ namespace discord {
 
         [[nodiscard]] MessageFrame& getFrame() const noexcept { return *m_frame; }
 
+        /// Gives up on a handshake Discord didn't answer
+        void abortHandshake() {
+            if (m_state == State::Disconnected || m_state == State::Connected) {
+                return;
+            }
+
+            m_lastError = ErrorCode::HandshakeTimeout;
+            m_lastErrorMessage = "Handshake timed out";
+            sendError();
+            this->close();
+        }
+
+        /// Transport of the current connection
+        [[nodiscard]] Transport& transport() const noexcept { return *m_transport; }
+
+        /// Changes every time the transport is opened, a reopened socket can get the same handle as the closed one
+        [[nodiscard]] uint64_t generation() const noexcept { return m_generation; }
+
+        /// Switches to another transport at the next connect, null for the platform's pipe
+        void setTransport(Transport* transport) noexcept {
+            m_requestedTransport.store(transport ? transport : &platform::PipeConnection::get());
+        }
+
     private:
+        /// Receive buffer size, always leaves room for at least one whole frame after compaction
+        static constexpr size_t ReadBufferSize = MessageFrame::MaxSize * 2;
+
+        void setState(State state) noexcept {
+            m_state = state;
+            FlightRecorder::get().record(ProtocolEvent::Kind::State, 0, uint8_t(state), 0);
+        }
+
+        /// Reads whatever the pipe has into the receive buffer
+        bool fill() {
+            // move the partial frame to the front once there might not be room for the rest of it
+            if (m_readStart == m_readEnd) {
+                m_readStart = m_readEnd = 0;
+            } else if (ReadBufferSize - m_readEnd < MessageFrame::MaxSize) {
+                std::memmove(m_readBuffer.get(), m_readBuffer.get() + m_readStart, m_readEnd - m_readStart);
+                m_readEnd -= m_readStart;
+                m_readStart = 0;
+            }
+
+            auto& conn = *m_transport;
+            auto received = conn.readSome(m_readBuffer.get() + m_readEnd, ReadBufferSize - m_readEnd);
+            if (received == 0) {
+                if (!conn.isOpen()) {
+                    m_lastError = ErrorCode::PipeClosed;
+                    m_lastErrorMessage = "Pipe closed";
+                    sendError();
+                    this->close();
+                }
+                return false;
+            }
+
+            m_readEnd += received;
+            Metrics::get().bytesReceived(received);
+            return true;
+        }
+
+        /// Sends what's left of partially written output
+        /// @return true once all of it is out, false if the pipe is full or closed
+        bool flush() {
+            if (m_pendingOutput.empty()) {
+                return true;
+            }
+
+            platform::IOBuffer buffer{m_pendingOutput.data(), m_pendingOutput.size()};
+            auto written = m_transport->writeSome({&buffer, 1});
+            Metrics::get().frameSent(written, 0);
+            m_pendingOutput.erase(0, written);
+
+            // frames ending in the part that just went out are complete now
+            size_t completed = 0;
+            for (auto& frame : m_pendingFrames) {
+                if (frame.end <= written) {
+                    this->frameWritten(frame);
+                    ++completed;
+                } else {
+                    frame.end -= written;
+                }
+            }
+            m_pendingFrames.erase(m_pendingFrames.begin(), m_pendingFrames.begin() + static_cast<std::ptrdiff_t>(completed));
+            return m_pendingOutput.empty();
+        }
+
+        /// Writes a control frame, whatever the pipe doesn't take right away is kept in the pending output
+        /// @return false if the pipe was closed
+        bool writeRaw(void const* data, size_t size) {
+            auto& conn = *m_transport;
+            size_t written = 0;
+            if (this->flush()) {
+                platform::IOBuffer buffer{data, size};
+                written = conn.writeSome({&buffer, 1});
+            }
+
+            Metrics::get().frameSent(written, 0);
+            if (!conn.isOpen()) {
+                return false;
+            }
+
+            Opcode opcode{};
+            std::memcpy(&opcode, data, std::min(size, sizeof(opcode)));
+            PendingFrame frame{m_pendingOutput.size() + size - written, uint8_t(opcode), size, 0};
+            if (written == size) {
+                this->frameWritten(frame);
+                return true;
+            }
+
+            m_pendingOutput.append(static_cast<char const*>(data) + written, size - written);
+            m_pendingFrames.push_back(frame);
+            return true;
+        }
+
+        /// A frame whose last byte is still in the pending output
+        struct PendingFrame {
+            size_t end;     ///< Offset in the pending output right after the frame
+            uint8_t opcode;
+            size_t size;
+            int32_t nonce;
+        };
+
+        /// Describes a command frame for the flight recorder
+        static PendingFrame pendingFrame(platform::IOBuffer const& buffer, size_t end) noexcept {
+            std::string_view payload(static_cast<char const*>(buffer.data), buffer.size);
+            payload.remove_prefix(MessageFrame::HeaderSize);
+            return {end, uint8_t(Opcode::Frame), buffer.size, FlightRecorder::findNonce(payload)};
+        }
+
+        /// Counts a frame once all of it was written
+        void frameWritten(PendingFrame const& frame) noexcept {
+            Metrics::get().frameSent(0);
+            FlightRecorder::get().record(ProtocolEvent::Kind::Sent, frame.opcode, uint8_t(m_state), frame.size, frame.nonce);
+        }
+
         State m_state = State::Disconnected;
+        Transport* m_transport = &platform::PipeConnection::get();
+        std::atomic<Transport*> m_requestedTransport = &platform::PipeConnection::get();
+        uint64_t m_generation = 0; ///< Number of times the transport was opened
         std::unique_ptr<MessageFrame> m_frame = std::make_unique<MessageFrame>();
+        std::unique_ptr<uint8_t[]> m_readBuffer = std::make_unique<uint8_t[]>(ReadBufferSize);
+        size_t m_readStart = 0; ///< Start of the first unparsed frame
+        size_t m_readEnd = 0;   ///< End of the received data
+        std::string m_pendingOutput; ///< Output the pipe didn't take yet, always sent first
+        std::vector<PendingFrame> m_pendingFrames; ///< Frames that end in the pending output, oldest first
         ErrorCode m_lastError = ErrorCode::Success;
         std::string m_lastErrorMessage{};
     };
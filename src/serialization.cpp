@@ -1,226 +1,260 @@
 #include "serialization.hpp"
+#include "tracing.hpp"
 
 #include <discord-rpc.hpp>
 #include <fmt/format.h>
 
-struct Timestamps {
-    std::optional<int64_t> start;
-    std::optional<int64_t> end;
-    constexpr Timestamps(int64_t start, int64_t end) noexcept {
-        if (start) { this->start = start; }
-        if (end) { this->end = end; }
-    }
-};
-
-struct Assets {
-    std::optional<std::string_view> large_image;
-    std::optional<std::string_view> large_text;
-    std::optional<std::string_view> small_image;
-    std::optional<std::string_view> small_text;
-    constexpr Assets(
-        std::string_view large_image,
-        std::string_view large_text,
-        std::string_view small_image,
-        std::string_view small_text
-    ) noexcept {
-        if (!large_image.empty()) { this->large_image = large_image; }
-        if (!large_text.empty()) { this->large_text = large_text; }
-        if (!small_image.empty()) { this->small_image = small_image; }
-        if (!small_text.empty()) { this->small_text = small_text; }
-    }
-};
-
-struct Party {
-    std::optional<std::string_view> id;
-    std::optional<std::array<int, 2>> size;
-    discord::PartyPrivacy privacy;
-
-    constexpr Party(
-        std::string const& id,
-        int size, int max,
-        discord::PartyPrivacy privacy
-    ) noexcept : privacy(privacy) {
-        if (!id.empty()) { this->id = id; }
-        if (size && max) { this->size = std::array{size, max}; }
-    }
-};
-
-struct Secrets {
-    std::optional<std::string_view> match;
-    std::optional<std::string_view> join;
-    std::optional<std::string_view> spectate;
-    constexpr Secrets(
-        std::string_view match,
-        std::string_view join,
-        std::string_view spectate
-    ) noexcept {
-        if (!match.empty()) { this->match = match; }
-        if (!join.empty()) { this->join = join; }
-        if (!spectate.empty()) { this->spectate = spectate; }
+#include <charconv>
+
+namespace {
+    /// Object key with its quotes and colon, built at compile time
+    template <size_t N>
+    struct Key {
+        char data[N + 2]{};
+
+        consteval Key(char const (&name)[N]) noexcept {
+            data[0] = '"';
+            for (size_t i = 0; i < N - 1; ++i) { data[i + 1] = name[i]; }
+            data[N] = '"';
+            data[N + 1] = ':';
+        }
+
+        [[nodiscard]] constexpr std::string_view view() const noexcept { return {data, N + 2}; }
+    };
+
+    namespace keys {
+        constexpr Key state{"state"};
+        constexpr Key details{"details"};
+        constexpr Key timestamps{"timestamps"};
+        constexpr Key start{"start"};
+        constexpr Key end{"end"};
+        constexpr Key assets{"assets"};
+        constexpr Key largeImage{"large_image"};
+        constexpr Key largeText{"large_text"};
+        constexpr Key smallImage{"small_image"};
+        constexpr Key smallText{"small_text"};
+        constexpr Key party{"party"};
+        constexpr Key id{"id"};
+        constexpr Key size{"size"};
+        constexpr Key privacy{"privacy"};
+        constexpr Key secrets{"secrets"};
+        constexpr Key match{"match"};
+        constexpr Key join{"join"};
+        constexpr Key spectate{"spectate"};
+        constexpr Key buttons{"buttons"};
+        constexpr Key label{"label"};
+        constexpr Key url{"url"};
+        constexpr Key instance{"instance"};
+        constexpr Key type{"type"};
+        constexpr Key statusDisplayType{"status_display_type"};
     }
-};
-
-struct Button {
-    std::string_view label;
-    std::string_view url;
-    constexpr Button(std::string_view label, std::string_view url) noexcept : label(label), url(url) {}
-};
-
-template <>
-struct glz::meta<Timestamps> {
-    using T = Timestamps;
-    static constexpr auto value = object(
-        "start", &T::start,
-        "end", &T::end
-    );
-};
-
-template <>
-struct glz::meta<Assets> {
-    using T = Assets;
-    static constexpr auto value = object(
-        "large_image", &T::large_image,
-        "large_text", &T::large_text,
-        "small_image", &T::small_image,
-        "small_text", &T::small_text
-    );
-};
-
-template <>
-struct glz::meta<Party> {
-    using T = Party;
-    static constexpr auto value = object(
-        "id", &T::id,
-        "size", &T::size,
-        "privacy", &T::privacy
-    );
-};
-
-template <>
-struct glz::meta<Secrets> {
-    using T = Secrets;
-    static constexpr auto value = object(
-        "match", &T::match,
-        "join", &T::join,
-        "spectate", &T::spectate
-    );
-};
-
-template <>
-struct glz::meta<Button> {
-    using T = Button;
-    static constexpr auto value = object(
-        "label", &T::label,
-        "url", &T::url
-    );
-};
-
-template <>
-struct glz::meta<discord::Presence> {
-    using T = discord::Presence;
-    static constexpr auto value = object(
-        "state", [](auto&& self) -> std::optional<std::string_view> {
-            if (self.getState().empty()) {
-                return std::nullopt;
-            }
-            return self.getState();
-        },
-        "details", [](auto&& self) -> std::optional<std::string_view> {
-            if (self.getDetails().empty()) {
-                return std::nullopt;
-            }
-            return self.getDetails();
-        },
-        "timestamps", [](auto&& self) -> std::optional<Timestamps> {
-            auto start = self.getStartTimestamp();
-            auto end = self.getEndTimestamp();
-
-            if (start || end) {
-                return Timestamps {start, end};
-            }
 
-            return std::nullopt;
-        },
-        "assets", [](auto&& self) -> std::optional<Assets> {
-            auto& large_image = self.getLargeImageKey();
-            auto& large_text = self.getLargeImageText();
-            auto& small_image = self.getSmallImageKey();
-            auto& small_text = self.getSmallImageText();
+    /// Appends JSON to a string in place. Only handles what presence needs, and
+    /// writes the same output as glaze does for the equivalent reflected types (see the unit tests).
+    /// Control characters without a short escape are the exception: glaze writes them raw,
+    /// which isn't valid JSON, they're written as `\u00XX` here.
+    class JsonWriter {
+    public:
+        explicit JsonWriter(std::string& out) noexcept : m_out(out) {}
+
+        void beginObject() { m_out.push_back('{'); m_first = true; }
+        void endObject() { m_out.push_back('}'); m_first = false; }
+        void beginArray() { m_out.push_back('['); m_first = true; }
+        void endArray() { m_out.push_back(']'); m_first = false; }
+
+        template <size_t N>
+        void key(Key<N> const& key) {
+            separate();
+            m_out.append(key.view());
+            m_first = true; // the value follows the key without a comma
+        }
 
-            if (!large_image.empty() || !large_text.empty() || !small_image.empty() || !small_text.empty()) {
-                return Assets {large_image, large_text, small_image, small_text};
+        /// Starts an array element
+        void element() { separate(); }
+
+        void value(std::string_view str) {
+            m_out.push_back('"');
+            size_t run = 0;
+            for (size_t i = 0; i < str.size(); ++i) {
+                auto c = static_cast<unsigned char>(str[i]);
+                if (c >= 0x20 && c != '"' && c != '\\') {
+                    continue;
+                }
+
+                m_out.append(str.substr(run, i - run));
+                run = i + 1;
+                switch (c) {
+                    case '"': m_out.append(R"(\")"); break;
+                    case '\\': m_out.append(R"(\\)"); break;
+                    case '\b': m_out.append(R"(\b)"); break;
+                    case '\f': m_out.append(R"(\f)"); break;
+                    case '\n': m_out.append(R"(\n)"); break;
+                    case '\r': m_out.append(R"(\r)"); break;
+                    case '\t': m_out.append(R"(\t)"); break;
+                    default: fmt::format_to(std::back_inserter(m_out), R"(\u{:04X})", c); break;
+                }
             }
+            m_out.append(str.substr(run));
+            m_out.push_back('"');
+            m_first = false;
+        }
 
-            return std::nullopt;
-        },
-        "party", [](auto&& self) -> std::optional<Party> {
-            auto& id = self.getPartyID();
-            auto size = self.getPartySize();
-            auto max = self.getPartyMax();
-            auto privacy = self.getPartyPrivacy();
+        void value(bool b) {
+            m_out.append(b ? "true" : "false");
+            m_first = false;
+        }
 
-            if (!id.empty() || size || max || privacy != discord::PartyPrivacy::Private) {
-                return Party {id, size, max, privacy};
-            }
+        template <typename T> requires std::is_integral_v<T>
+        void value(T number) {
+            char buf[24];
+            auto res = std::to_chars(buf, buf + sizeof(buf), number);
+            m_out.append(buf, res.ptr);
+            m_first = false;
+        }
 
-            return std::nullopt;
-        },
-        "secrets", [](auto&& self) -> std::optional<Secrets> {
-            auto& match = self.getMatchSecret();
-            auto& join = self.getJoinSecret();
-            auto& spectate = self.getSpectateSecret();
+        template <typename T> requires std::is_enum_v<T>
+        void value(T e) { value(static_cast<std::underlying_type_t<T>>(e)); }
 
-            if (!match.empty() || !join.empty() || !spectate.empty()) {
-                return Secrets {match, join, spectate};
-            }
+        template <size_t N, typename T>
+        void field(Key<N> const& name, T const& v) {
+            key(name);
+            value(v);
+        }
+
+        /// Writes the field only if the string is not empty
+        template <size_t N>
+        void optional(Key<N> const& name, std::string const& str) {
+            if (!str.empty()) { field(name, std::string_view(str)); }
+        }
+
+    private:
+        void separate() {
+            if (!m_first) { m_out.push_back(','); }
+            m_first = false;
+        }
+
+        std::string& m_out;
+        bool m_first = true;
+    };
+
+    void writeActivity(JsonWriter& w, discord::Presence const& self) {
+        w.beginObject();
+
+        w.optional(keys::state, self.getState());
+        w.optional(keys::details, self.getDetails());
 
-            return std::nullopt;
-        },
-        "buttons", [](auto&& self) -> std::optional<std::vector<Button>> {
-            auto& btn1 = self.getButton1();
-            auto& btn2 = self.getButton2();
+        auto start = self.getStartTimestamp();
+        auto end = self.getEndTimestamp();
+        if (start || end) {
+            w.key(keys::timestamps);
+            w.beginObject();
+            if (start) { w.field(keys::start, start); }
+            if (end) { w.field(keys::end, end); }
+            w.endObject();
+        }
+
+        auto& largeImage = self.getLargeImageKey();
+        auto& largeText = self.getLargeImageText();
+        auto& smallImage = self.getSmallImageKey();
+        auto& smallText = self.getSmallImageText();
+        if (!largeImage.empty() || !largeText.empty() || !smallImage.empty() || !smallText.empty()) {
+            w.key(keys::assets);
+            w.beginObject();
+            w.optional(keys::largeImage, largeImage);
+            w.optional(keys::largeText, largeText);
+            w.optional(keys::smallImage, smallImage);
+            w.optional(keys::smallText, smallText);
+            w.endObject();
+        }
 
-            if (!btn1.isEnabled() && !btn2.isEnabled()) {
-                return std::nullopt;
+        auto& partyID = self.getPartyID();
+        auto size = self.getPartySize();
+        auto max = self.getPartyMax();
+        auto privacy = self.getPartyPrivacy();
+        if (!partyID.empty() || size || max || privacy != discord::PartyPrivacy::Private) {
+            w.key(keys::party);
+            w.beginObject();
+            w.optional(keys::id, partyID);
+            if (size && max) {
+                w.key(keys::size);
+                w.beginArray();
+                w.element(); w.value(size);
+                w.element(); w.value(max);
+                w.endArray();
             }
+            w.field(keys::privacy, privacy);
+            w.endObject();
+        }
+
+        auto& match = self.getMatchSecret();
+        auto& join = self.getJoinSecret();
+        auto& spectate = self.getSpectateSecret();
+        bool hasSecrets = !match.empty() || !join.empty() || !spectate.empty();
+        if (hasSecrets) {
+            w.key(keys::secrets);
+            w.beginObject();
+            w.optional(keys::match, match);
+            w.optional(keys::join, join);
+            w.optional(keys::spectate, spectate);
+            w.endObject();
+        }
 
-            // if secrets are set, buttons are disabled
-            if (!self.getMatchSecret().empty() || !self.getJoinSecret().empty() || !self.getSpectateSecret().empty()) {
-                return std::nullopt;
+        // if secrets are set, buttons are disabled
+        auto& btn1 = self.getButton1();
+        auto& btn2 = self.getButton2();
+        if ((btn1.isEnabled() || btn2.isEnabled()) && !hasSecrets) {
+            w.key(keys::buttons);
+            w.beginArray();
+            for (auto* btn : {&btn1, &btn2}) {
+                if (!btn->isEnabled()) { continue; }
+                w.element();
+                w.beginObject();
+                w.field(keys::label, std::string_view(btn->getLabel()));
+                w.field(keys::url, std::string_view(btn->getURL()));
+                w.endObject();
             }
+            w.endArray();
+        }
 
-            std::vector<Button> buttons;
-            buttons.reserve(2);
-            if (btn1.isEnabled()) { buttons.emplace_back(btn1.getLabel(), btn1.getURL()); }
-            if (btn2.isEnabled()) { buttons.emplace_back(btn2.getLabel(), btn2.getURL()); }
+        w.field(keys::instance, self.getInstance());
+        w.field(keys::type, self.getActivityType());
+        w.field(keys::statusDisplayType, self.getStatusDisplayType());
 
-            return buttons;
-        },
-        "instance", [](auto&& self) { return self.getInstance(); },
-        "type", [](auto&& self) { return self.getActivityType(); },
-        "status_display_type", [](auto&& self) { return self.getStatusDisplayType(); }
-    );
-};
+        w.endObject();
+    }
+}
 
 namespace discord {
     void serializeEmptyPresence(std::string& buffer, size_t pid, int nonce) {
-        buffer = fmt::format(
+        // resize keeps the capacity of recycled buffers, so this doesn't allocate in steady state
+        buffer.resize(FrameHeaderSize);
+        fmt::format_to(
+            std::back_inserter(buffer),
             R"({{"nonce":"{}","cmd":"SET_ACTIVITY","args":{{"pid":{}}}}})",
             nonce, pid
         );
     }
 
-    void serializePresence(std::string& buffer, Presence const& presence, size_t pid, int nonce) {
-        auto res = glz::write<glz::opts{.error_on_unknown_keys = false}>(presence);
-        if (!res) {
-            buffer = "";
-            return;
-        }
-
-        buffer = fmt::format(
-            R"({{"nonce":"{}","cmd":"SET_ACTIVITY","args":{{"pid":{},"activity":{}}}}})",
-            nonce, pid, res.value()
+    std::string_view serializePresence(std::string& buffer, Presence const& presence, size_t pid, int nonce) {
+        DISCORD_TRACE_ZONE("serializePresence");
+        buffer.resize(FrameHeaderSize);
+        fmt::format_to(
+            std::back_inserter(buffer),
+            R"({{"nonce":"{}","cmd":"SET_ACTIVITY","args":{{"pid":{},"activity":)",
+            nonce, pid
         );
+
+        auto activityStart = buffer.size();
+        JsonWriter writer(buffer);
+        writeActivity(writer, presence);
+        auto activityEnd = buffer.size();
+
+        buffer.append("}}");
+        return std::string_view(buffer).substr(activityStart, activityEnd - activityStart);
+    }
+
+    uint64_t hashPayload(std::string_view payload) noexcept {
+        return std::hash<std::string_view>{}(payload);
     }
 
     size_t serializeHandshake(uint8_t* buf, size_t bufSize, uint32_t rpcVersion, std::string_view appID) {
@@ -231,21 +265,22 @@ namespace discord {
         return size;
     }
 
-    size_t serializeSubscribeCommand(uint8_t* buf, size_t bufSize, int nonce, std::string_view event) {
-        constexpr auto format = R"({{"nonce":"{}","cmd":"SUBSCRIBE","evt":"{}"}})";
-        auto size = fmt::formatted_size(format, nonce, event);
-        if (size > bufSize) { return 0; }
-        fmt::format_to(buf, format, nonce, event);
-        return size;
+    void serializeCommand(std::string& buffer, int nonce, std::string_view command, std::string_view args) {
+        buffer.resize(FrameHeaderSize);
+        fmt::format_to(
+            std::back_inserter(buffer), R"({{"nonce":"{}","cmd":"{}","args":{}}})",
+            nonce, command, args.empty() ? std::string_view("{}") : args
+        );
     }
 
-    size_t serializeUnsubscribeCommand(uint8_t* buf, size_t bufSize, int nonce, std::string_view event) {
-        constexpr auto format = R"({{"nonce":"{}","cmd":"UNSUBSCRIBE","evt":"{}"}})";
-        auto size = fmt::formatted_size(format, nonce, event);
-        if (size > bufSize) { return 0; }
-        fmt::format_to(buf, format, nonce, event);
-        return size;
+    void serializeSubscribeCommand(std::string& buffer, int nonce, std::string_view event) {
+        buffer.resize(FrameHeaderSize);
+        fmt::format_to(std::back_inserter(buffer), R"({{"nonce":"{}","cmd":"SUBSCRIBE","evt":"{}"}})", nonce, event);
     }
-}
 
+    void serializeUnsubscribeCommand(std::string& buffer, int nonce, std::string_view event) {
+        buffer.resize(FrameHeaderSize);
+        fmt::format_to(std::back_inserter(buffer), R"({{"nonce":"{}","cmd":"UNSUBSCRIBE","evt":"{}"}})", nonce, event);
+    }
+}
 
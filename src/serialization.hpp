@@ -10,11 +10,18 @@
 namespace discord {
     class Presence;
 
+    /// Serializers writing into std::string leave this many bytes at the start of the buffer,
+    /// so the IPC frame header can be filled in place and the buffer sent as is.
+    constexpr size_t FrameHeaderSize = sizeof(uint32_t) * 2;
+
     void serializeEmptyPresence(std::string& buffer, size_t pid, int nonce);
-    void serializePresence(std::string& buffer, Presence const& presence, size_t pid, int nonce);
+    /// @return The activity object within `buffer`, valid until the buffer is modified
+    std::string_view serializePresence(std::string& buffer, Presence const& presence, size_t pid, int nonce);
+    uint64_t hashPayload(std::string_view payload) noexcept;
     size_t serializeHandshake(uint8_t* buf, size_t bufSize, uint32_t rpcVersion, std::string_view appID);
-    size_t serializeSubscribeCommand(uint8_t* buf, size_t bufSize, int nonce, std::string_view event);
-    size_t serializeUnsubscribeCommand(uint8_t* buf, size_t bufSize, int nonce, std::string_view event);
+    void serializeCommand(std::string& buffer, int nonce, std::string_view command, std::string_view args);
+    void serializeSubscribeCommand(std::string& buffer, int nonce, std::string_view event);
+    void serializeUnsubscribeCommand(std::string& buffer, int nonce, std::string_view event);
 }
 
 #endif // DISCORD_SERIALIZATION_HPP
\ No newline at end of file
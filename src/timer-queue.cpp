@@ -0,0 +1,55 @@
+#include <discord-rpc/timer-queue.hpp>
+
+#include <algorithm>
+
+namespace discord {
+    TimerQueue::TimerID TimerQueue::schedule(Clock::time_point deadline, std::function<void()> callback) {
+        std::lock_guard lock(m_mutex);
+        auto id = m_nextID++;
+        m_heap.push_back({deadline, id, std::move(callback)});
+        std::push_heap(m_heap.begin(), m_heap.end());
+        return id;
+    }
+
+    bool TimerQueue::cancel(TimerID id) noexcept {
+        // there are only ever a handful of timers, a linear search beats bookkeeping
+        std::lock_guard lock(m_mutex);
+        auto it = std::find_if(m_heap.begin(), m_heap.end(), [id](Entry const& entry) { return entry.id == id; });
+        if (it == m_heap.end()) {
+            return false;
+        }
+
+        m_heap.erase(it);
+        std::make_heap(m_heap.begin(), m_heap.end());
+        return true;
+    }
+
+    std::optional<TimerQueue::Clock::time_point> TimerQueue::next() const noexcept {
+        std::lock_guard lock(m_mutex);
+        if (m_heap.empty()) {
+            return std::nullopt;
+        }
+        return m_heap.front().deadline;
+    }
+
+    size_t TimerQueue::runDue(Clock::time_point now) {
+        size_t ran = 0;
+        while (true) {
+            std::function<void()> callback;
+            {
+                std::lock_guard lock(m_mutex);
+                if (m_heap.empty() || m_heap.front().deadline > now) {
+                    return ran;
+                }
+
+                std::pop_heap(m_heap.begin(), m_heap.end());
+                callback = std::move(m_heap.back().callback);
+                m_heap.pop_back();
+            }
+
+            // without the lock, so callbacks can schedule and cancel timers
+            if (callback) { callback(); }
+            ++ran;
+        }
+    }
+}
@@ -0,0 +1,15 @@
+#include "tracing.hpp"
+
+namespace discord {
+    namespace tracing {
+        static std::atomic<TraceBackend*> s_backend = nullptr;
+
+        TraceBackend* backend() noexcept {
+            return s_backend.load(std::memory_order_acquire);
+        }
+
+        void setBackend(TraceBackend* backend) noexcept {
+            s_backend.store(backend, std::memory_order_release);
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+#ifndef DISCORD_TRACING_HPP
+#define DISCORD_TRACING_HPP
+
+#include <discord-rpc/tracing.hpp>
+
+#include <atomic>
+
+namespace discord::tracing {
+    /// The backend set with `RPCManager::setTraceBackend`, null if none
+    TraceBackend* backend() noexcept;
+    void setBackend(TraceBackend* backend) noexcept;
+
+    /// Scoped zone, the backend is looked up once so a zone always ends where it began
+    class Zone {
+    public:
+        explicit Zone(char const* name) noexcept : m_name(name), m_backend(backend()) {
+            if (m_backend) { m_backend->beginZone(m_name); }
+        }
+
+        ~Zone() noexcept {
+            if (m_backend) { m_backend->endZone(m_name); }
+        }
+
+        Zone(Zone const&) = delete;
+        Zone& operator=(Zone const&) = delete;
+
+    private:
+        char const* m_name;
+        TraceBackend* m_backend;
+    };
+
+    inline void complete(char const* name, TraceBackend::Clock::time_point start, TraceBackend::Clock::time_point end) noexcept {
+        if (auto* tracer = backend()) { tracer->completeZone(name, start, end); }
+    }
+}
+
+#ifdef DISCORD_ENABLE_TRACING
+    #define DISCORD_TRACE_CONCAT_IMPL(a, b) a##b
+    #define DISCORD_TRACE_CONCAT(a, b) DISCORD_TRACE_CONCAT_IMPL(a, b)
+    #define DISCORD_TRACE_ZONE(name) ::discord::tracing::Zone DISCORD_TRACE_CONCAT(discordTraceZone, __LINE__)(name)
+    #define DISCORD_TRACE_COMPLETE(name, start, end) ::discord::tracing::complete(name, start, end)
+#else
+    #define DISCORD_TRACE_ZONE(name) ((void) 0)
+    #define DISCORD_TRACE_COMPLETE(name, start, end) ((void) 0)
+#endif
+
+#endif // DISCORD_TRACING_HPP
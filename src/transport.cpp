@@ -0,0 +1,154 @@
+#include <discord-rpc/transport.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+namespace discord {
+    bool LoopbackTransport::open() noexcept {
+        std::lock_guard lock(m_mutex);
+        if (m_open || !m_listening) {
+            return false;
+        }
+
+        m_toPeer.clear();
+        m_toLibrary.clear();
+        m_readOffset = 0;
+        m_open = true;
+        ++m_connections;
+        return true;
+    }
+
+    bool LoopbackTransport::close() noexcept {
+        std::lock_guard lock(m_mutex);
+        if (!m_open) {
+            return false;
+        }
+
+        m_open = false;
+        return true;
+    }
+
+    bool LoopbackTransport::isOpen() const noexcept {
+        std::lock_guard lock(m_mutex);
+        return m_open;
+    }
+
+    size_t LoopbackTransport::writeSome(std::span<IOBuffer const> buffers) noexcept {
+        size_t written = 0;
+        std::function<void(LoopbackTransport&)> handler;
+        {
+            std::lock_guard lock(m_mutex);
+            if (!m_open) {
+                return 0;
+            }
+
+            for (auto const& buffer : buffers) {
+                auto size = buffer.size;
+                if (m_writeCapacity) {
+                    size = std::min(size, m_writeCapacity - std::min(m_writeCapacity, m_toPeer.size()));
+                }
+
+                m_toPeer.append(static_cast<char const*>(buffer.data), size);
+                written += size;
+                if (size < buffer.size) {
+                    break;
+                }
+            }
+
+            handler = m_peerHandler;
+        }
+
+        if (handler && written > 0) {
+            handler(*this);
+        }
+        return written;
+    }
+
+    size_t LoopbackTransport::readSome(void* data, size_t capacity) noexcept {
+        std::lock_guard lock(m_mutex);
+        if (!m_open) {
+            return 0;
+        }
+
+        auto size = std::min(capacity, m_toLibrary.size() - m_readOffset);
+        std::memcpy(data, m_toLibrary.data() + m_readOffset, size);
+        m_readOffset += size;
+        if (m_readOffset == m_toLibrary.size()) {
+            // keeps the capacity, so a steady exchange doesn't allocate
+            m_toLibrary.clear();
+            m_readOffset = 0;
+        }
+        return size;
+    }
+
+    void LoopbackTransport::setListening(bool listening) noexcept {
+        std::lock_guard lock(m_mutex);
+        m_listening = listening;
+    }
+
+    void LoopbackTransport::setWriteCapacity(size_t capacity) noexcept {
+        std::lock_guard lock(m_mutex);
+        m_writeCapacity = capacity;
+    }
+
+    void LoopbackTransport::setPeerHandler(std::function<void(LoopbackTransport&)> handler) noexcept {
+        std::lock_guard lock(m_mutex);
+        m_peerHandler = std::move(handler);
+    }
+
+    size_t LoopbackTransport::peerRead(std::string& out) {
+        bool freed = false;
+        size_t size;
+        {
+            std::lock_guard lock(m_mutex);
+            size = m_toPeer.size();
+            out.append(m_toPeer);
+            m_toPeer.clear();
+            freed = size > 0 && m_writeCapacity != 0;
+        }
+
+        // the library may be waiting for room to finish a write
+        if (freed) {
+            wakeup();
+        }
+        return size;
+    }
+
+    bool LoopbackTransport::peerWrite(std::string_view bytes) {
+        {
+            std::lock_guard lock(m_mutex);
+            if (!m_open) {
+                return false;
+            }
+            m_toLibrary.append(bytes);
+        }
+
+        wakeup();
+        return true;
+    }
+
+    bool LoopbackTransport::peerWriteFrame(uint32_t opcode, std::string_view payload) {
+        auto length = static_cast<uint32_t>(payload.size());
+        std::string frame(sizeof(opcode) + sizeof(length) + payload.size(), '\0');
+        std::memcpy(frame.data(), &opcode, sizeof(opcode));
+        std::memcpy(frame.data() + sizeof(opcode), &length, sizeof(length));
+        std::memcpy(frame.data() + sizeof(opcode) + sizeof(length), payload.data(), payload.size());
+        return peerWrite(frame);
+    }
+
+    void LoopbackTransport::peerClose() {
+        {
+            std::lock_guard lock(m_mutex);
+            m_open = false;
+            m_toLibrary.clear();
+            m_readOffset = 0;
+        }
+
+        wakeup();
+    }
+
+    size_t LoopbackTransport::connections() const noexcept {
+        std::lock_guard lock(m_mutex);
+        return m_connections;
+    }
+}
@@ -1,7 +1,19 @@
 #include <discord-rpc.hpp>
+#include <glaze/glaze.hpp>
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <future>
 #include <iostream>
+#include <optional>
+#include <string_view>
+#include <thread>
+#include <vector>
 #include <fmt/format.h>
 
+#include "rpc-connection.hpp"
+#include "serialization.hpp"
+
 constexpr auto APPLICATION_ID = "345229890980937739";
 static uint32_t FrustrationLevel = 0;
 static int64_t StartTime;
@@ -119,7 +131,523 @@ static void gameLoop() {
     } while (true);
 }
 
-int main() {
+// Unit tests, run with `--unit` (that's what ctest does)
+
+static uint32_t Failures = 0;
+
+static void check(bool passed, std::string_view expression, int line) {
+    if (!passed) {
+        ++Failures;
+        fmt::println("test/main.cpp:{}: check failed: {}", line, expression);
+    }
+}
+
+#define CHECK(expression) check(static_cast<bool>(expression), #expression, __LINE__)
+
+/// Commands of a drained batch, in order
+static std::vector<std::string> batchOf(discord::CommandQueue& queue, bool includeActivity = true) {
+    std::vector<std::string> commands;
+    for (auto const& entry : queue.drain(includeActivity)) {
+        commands.push_back(entry.command);
+    }
+    return commands;
+}
+
+using Commands = std::vector<std::string>;
+
+static void testQueueWraparound() {
+    using discord::CommandQueue;
+    CommandQueue queue(4);
+    queue.setCoalescing(false);
+
+    // go around the ring several times, a full ring refuses commands until the consumer frees slots
+    int next = 0;
+    for (int round = 0; round < 5; ++round) {
+        for (int i = 0; i < 4; ++i) {
+            CHECK(queue.push(fmt::format("{}", next + i)));
+        }
+        CHECK(!queue.push("overflow"));
+        CHECK(queue.size() == 4);
+
+        auto batch = batchOf(queue);
+        CHECK(batch == Commands({fmt::format("{}", next), fmt::format("{}", next + 1), fmt::format("{}", next + 2), fmt::format("{}", next + 3)}));
+        queue.consume(batch.size());
+        CHECK(queue.empty());
+        next += 4;
+    }
+
+    // commands that weren't sent stay in front of newer ones
+    queue.push("a");
+    queue.push("b");
+    CHECK(batchOf(queue) == Commands({"a", "b"}));
+    queue.consume(1);
+    queue.push("c");
+    CHECK(batchOf(queue) == Commands({"b", "c"}));
+}
+
+static void testQueueOverflowSlot() {
+    using discord::CommandQueue;
+    using discord::CommandType;
+    CommandQueue queue(2);
+
+    // a full ring doesn't lose the newest presence, it waits in the overflow slot behind the queued commands
+    CHECK(queue.push("g1"));
+    CHECK(queue.push("g2"));
+    CHECK(queue.push("a1", CommandType::Activity));
+    CHECK(queue.push("a2", CommandType::Activity));
+    CHECK(!queue.push("g3"));
+    CHECK(queue.size() == 3);
+    CHECK(queue.superseded() == 1);
+
+    CHECK(batchOf(queue) == Commands({"g1", "g2", "a2"}));
+    queue.consume(3);
+    CHECK(queue.empty());
+
+    // activities from the ring and the overflow slot are ordered by submit, not by where they ended up
+    CHECK(queue.push("a3", CommandType::Activity));
+    CHECK(queue.push("g4"));
+    CHECK(queue.push("a4", CommandType::Activity));
+    CHECK(batchOf(queue) == Commands({"g4", "a4"}));
+    CHECK(queue.superseded() == 2);
+
+    // without coalescing, a full ring refuses activities too
+    queue.consume(2);
+    queue.setCoalescing(false);
+    CHECK(queue.push("g5"));
+    CHECK(queue.push("g6"));
+    CHECK(!queue.push("a5", CommandType::Activity));
+}
+
+static void testQueueCoalescing() {
+    using discord::CommandQueue;
+    using discord::CommandType;
+    CommandQueue queue;
+
+    // only the newest activity is sent, behind the commands queued before it was ready
+    queue.push("a1", CommandType::Activity);
+    queue.push("g1");
+    queue.push("a2", CommandType::Activity);
+    queue.push("g2");
+    CHECK(batchOf(queue) == Commands({"g1", "g2", "a2"}));
+    CHECK(queue.superseded() == 1);
+    queue.consume(3);
+
+    // a debounced activity is held back until the window passed
+    queue.setCoalescing(true, std::chrono::milliseconds(50));
+    queue.push("a3", CommandType::Activity);
+    CHECK(batchOf(queue).empty());
+    auto deadline = queue.pendingDeadline();
+    CHECK(deadline.has_value());
+    if (deadline) {
+        std::this_thread::sleep_until(*deadline);
+    }
+    CHECK(batchOf(queue) == Commands({"a3"}));
+    queue.consume(1);
+    CHECK(!queue.pendingDeadline());
+
+    // turning coalescing off keeps every activity, and the held one isn't lost
+    queue.setCoalescing(true);
+    queue.push("a4", CommandType::Activity);
+    queue.collect();
+    queue.setCoalescing(false);
+    queue.push("a5", CommandType::Activity);
+    queue.push("a6", CommandType::Activity);
+    CHECK(batchOf(queue) == Commands({"a4", "a5", "a6"}));
+}
+
+static void testQueueLentActivity() {
+    using discord::CommandQueue;
+    using discord::CommandType;
+    CommandQueue queue;
+
+    // the activity is only lent to the batch, one that wasn't sent is replaced by a newer one
+    queue.push("g1");
+    queue.push("a1", CommandType::Activity);
+    CHECK(batchOf(queue) == Commands({"g1", "a1"}));
+    queue.consume(1);
+    CHECK(queue.size() == 1);
+
+    queue.push("a2", CommandType::Activity);
+    CHECK(batchOf(queue, false).empty());
+    CHECK(queue.size() == 1);
+    CHECK(batchOf(queue) == Commands({"a2"}));
+    CHECK(queue.superseded() == 1);
+
+    // a presence drained without its rate limit token stays put for the next drain
+    queue.consume(0);
+    queue.push("g2");
+    CHECK(batchOf(queue, false) == Commands({"g2"}));
+    queue.consume(1);
+    CHECK(batchOf(queue) == Commands({"a2"}));
+    queue.consume(1);
+    CHECK(queue.empty());
+}
+
+static void testQueueProducers() {
+    using discord::CommandQueue;
+    constexpr size_t Producers = 4;
+    constexpr size_t PerProducer = 20'000;
+    CommandQueue queue(64);
+
+    std::vector<std::thread> producers;
+    for (size_t producer = 0; producer < Producers; ++producer) {
+        producers.emplace_back([&queue, producer] {
+            std::string buffer;
+            for (size_t i = 0; i < PerProducer; ++i) {
+                buffer = fmt::format("{}:{}", producer, i);
+                while (!queue.submit(buffer)) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    // every command arrives once, and in the order its producer submitted them
+    std::vector<size_t> next(Producers, 0);
+    size_t received = 0;
+    bool ordered = true;
+    while (received < Producers * PerProducer) {
+        auto batch = queue.drain();
+        for (auto const& entry : batch) {
+            auto colon = entry.command.find(':');
+            auto producer = std::stoul(entry.command.substr(0, colon));
+            auto index = std::stoul(entry.command.substr(colon + 1));
+            ordered = ordered && producer < Producers && index == next[producer];
+            if (producer < Producers) { next[producer] = index + 1; }
+        }
+        received += batch.size();
+        queue.consume(batch.size());
+        if (batch.empty()) {
+            std::this_thread::yield();
+        }
+    }
+
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    CHECK(ordered);
+    CHECK(received == Producers * PerProducer);
+    CHECK(queue.empty());
+}
+
+static void testQueuePolicies() {
+    using discord::CommandQueue;
+    using discord::CommandType;
+    using discord::QueuePolicy;
+
+    // Reject: new commands are dropped, and whoever waits for them is told
+    {
+        CommandQueue queue;
+        queue.setLimits(2, QueuePolicy::Reject);
+        queue.push("g1", CommandType::Generic, 1);
+        queue.push("g2", CommandType::Generic, 2);
+        queue.push("g3", CommandType::Generic, 3);
+        CHECK(batchOf(queue) == Commands({"g1", "g2"}));
+        CHECK(queue.takeDropped() == std::vector<int>({3}));
+        CHECK(queue.dropped() == 1);
+    }
+
+    // DropOldest: only commands that were queued before the current collect() make room
+    {
+        CommandQueue queue;
+        queue.setLimits(2, QueuePolicy::DropOldest);
+        queue.push("g1", CommandType::Generic, 1);
+        queue.push("g2", CommandType::Generic, 2);
+        queue.push("g3", CommandType::Generic, 3);
+        CHECK(batchOf(queue) == Commands({"g1", "g2"}));
+        CHECK(queue.takeDropped() == std::vector<int>({3}));
+
+        queue.push("g4", CommandType::Generic, 4);
+        CHECK(batchOf(queue) == Commands({"g2", "g4"}));
+        CHECK(queue.takeDropped() == std::vector<int>({1}));
+    }
+
+    // a held presence alone doesn't keep a command out
+    for (auto policy : {QueuePolicy::KeepLatestPresence, QueuePolicy::DropOldest, QueuePolicy::Reject}) {
+        CommandQueue queue;
+        queue.setLimits(1, policy);
+        queue.setCoalescing(true, std::chrono::seconds(60));
+        queue.push("a1", CommandType::Activity);
+        queue.push("g1", CommandType::Generic, 1);
+        CHECK(batchOf(queue) == Commands({"g1"}));
+        CHECK(queue.takeDropped().empty());
+    }
+
+    // KeepLatestPresence: a new presence replaces the oldest one, other commands are dropped
+    {
+        CommandQueue queue;
+        queue.setLimits(3, QueuePolicy::KeepLatestPresence);
+        queue.setCoalescing(false);
+        queue.push("a1", CommandType::Activity);
+        queue.push("g1", CommandType::Generic, 1);
+        queue.push("a2", CommandType::Activity);
+        queue.push("a3", CommandType::Activity);
+        queue.push("g2", CommandType::Generic, 2);
+        CHECK(batchOf(queue) == Commands({"g1", "a2", "a3"}));
+        CHECK(queue.takeDropped() == std::vector<int>({2}));
+        CHECK(queue.dropped() == 2);
+    }
+
+    // while disconnected, only superseded presences are dropped, commands are kept for the next connection
+    for (auto policy : {QueuePolicy::KeepLatestPresence, QueuePolicy::DropOldest, QueuePolicy::Reject}) {
+        CommandQueue queue;
+        queue.setLimits(8, policy);
+        queue.setCoalescing(false);
+        queue.push("a1", CommandType::Activity);
+        queue.push("g1", CommandType::Generic, 1);
+        queue.push("a2", CommandType::Activity);
+        queue.push("g2", CommandType::Generic, 2);
+        queue.prune();
+        CHECK(queue.takeDropped().empty());
+        CHECK(batchOf(queue) == Commands({"g1", "a2", "g2"}));
+    }
+}
+
+/// What Discord reads from SET_ACTIVITY, parsed back with glaze. Fields the writer leaves out stay empty
+namespace parsed {
+    struct Timestamps {
+        std::optional<int64_t> start;
+        std::optional<int64_t> end;
+    };
+
+    struct Assets {
+        std::optional<std::string> large_image;
+        std::optional<std::string> large_text;
+        std::optional<std::string> small_image;
+        std::optional<std::string> small_text;
+    };
+
+    struct Party {
+        std::optional<std::string> id;
+        std::optional<std::array<int32_t, 2>> size;
+        int32_t privacy = 0;
+    };
+
+    struct Secrets {
+        std::optional<std::string> match;
+        std::optional<std::string> join;
+        std::optional<std::string> spectate;
+    };
+
+    struct Button {
+        std::string label;
+        std::string url;
+    };
+
+    struct Activity {
+        std::optional<std::string> state;
+        std::optional<std::string> details;
+        std::optional<Timestamps> timestamps;
+        std::optional<Assets> assets;
+        std::optional<Party> party;
+        std::optional<Secrets> secrets;
+        std::optional<std::vector<Button>> buttons;
+        bool instance = false;
+        int32_t type = 0;
+        int32_t status_display_type = 0;
+    };
+}
+
+/// Serializes the presence and parses the activity back, unknown keys fail the parse
+static std::optional<parsed::Activity> roundTrip(discord::Presence const& presence, std::string& activity) {
+    std::string buffer;
+    activity = discord::serializePresence(buffer, presence, 1234, 7);
+
+    parsed::Activity result;
+    if (glz::read_json(result, activity)) {
+        return std::nullopt;
+    }
+    return result;
+}
+
+static void testPresenceSerialization() {
+    discord::Presence presence;
+    presence
+        .setState("Quote \" backslash \\ slash / tab \t newline \n")
+        .setDetails("Unicode: \u00dcnic\u00f6de \u2713 \U0001F3AE")
+        .setStartTimestamp(1700000000)
+        .setLargeImageKey("canary-large")
+        .setSmallImageText("\b\f\r")
+        .setPartyID("party1234")
+        .setPartySize(2)
+        .setPartyMax(6)
+        .setPartyPrivacy(discord::PartyPrivacy::Public)
+        .setActivityType(discord::ActivityType::Game)
+        .setButton1("Click me!", "https://google.com/")
+        .setInstance(true);
+
+    std::string activity;
+    auto full = roundTrip(presence, activity);
+    CHECK(full.has_value());
+    if (full) {
+        CHECK(full->state == presence.getState());
+        CHECK(full->details == presence.getDetails());
+        CHECK(full->timestamps && full->timestamps->start == 1700000000 && !full->timestamps->end);
+        CHECK(full->assets && full->assets->large_image == "canary-large" && !full->assets->large_text);
+        CHECK(full->assets && full->assets->small_text == "\b\f\r" && !full->assets->small_image);
+        CHECK(full->party && full->party->id == "party1234" && full->party->privacy == 1);
+        constexpr std::array<int32_t, 2> partySize{2, 6};
+        CHECK(full->party && full->party->size == partySize);
+        CHECK(!full->secrets);
+        CHECK(full->buttons && full->buttons->size() == 1 && full->buttons->front().url == "https://google.com/");
+        CHECK(full->instance);
+        CHECK(full->type == static_cast<int32_t>(discord::ActivityType::Game));
+
+        // glaze writes the same fields the same way
+        CHECK(glz::write_json(*full).value_or("") == activity);
+    }
+
+    // empty fields are left out, secrets turn the buttons off
+    presence.clear();
+    presence.setDetails("Details").setJoinSecret("join").setButton1("Click me!", "https://google.com/");
+    auto partial = roundTrip(presence, activity);
+    CHECK(partial.has_value());
+    if (partial) {
+        CHECK(!partial->state && partial->details == "Details");
+        CHECK(!partial->timestamps && !partial->assets && !partial->party && !partial->buttons);
+        CHECK(partial->secrets && partial->secrets->join == "join" && !partial->secrets->match);
+        CHECK(glz::write_json(*partial).value_or("") == activity);
+    }
+
+    // control characters without a short escape are written as \u escapes, glaze would write them raw
+    presence.clear();
+    presence.setState(std::string("bell \a nul ") + '\0' + " unit \x1f");
+    auto control = roundTrip(presence, activity);
+    CHECK(control && control->state == presence.getState());
+    CHECK(activity.find("\\u0007") != std::string::npos && activity.find("\\u001F") != std::string::npos);
+}
+
+/// Plays Discord on the other end of a loopback transport: READY for every handshake and an empty
+/// success for every command. Keeps the commands of the current connection, so tests can wait for them
+class SimulatedDiscord {
+public:
+    void operator()(discord::LoopbackTransport& transport) {
+        using discord::Connection;
+        using Frame = Connection::MessageFrame;
+
+        transport.peerRead(m_input);
+        size_t offset = 0;
+        while (m_input.size() - offset >= Frame::HeaderSize) {
+            Connection::Opcode opcode;
+            uint32_t length;
+            Frame::readHeader(m_input.data() + offset, opcode, length);
+            if (m_input.size() - offset < Frame::HeaderSize + length) {
+                break;
+            }
+
+            std::string payload(m_input.data() + offset + Frame::HeaderSize, length);
+            offset += Frame::HeaderSize + length;
+
+            if (opcode == Connection::Opcode::Handshake) {
+                {
+                    std::lock_guard lock(m_mutex);
+                    ++m_connections;
+                    m_commands.clear();
+                }
+                transport.peerWriteFrame(uint32_t(Connection::Opcode::Frame), Ready);
+            } else if (opcode == Connection::Opcode::Frame) {
+                transport.peerWriteFrame(uint32_t(Connection::Opcode::Frame), fmt::format(
+                    R"({{"cmd":"{}","data":{{}},"evt":null,"nonce":"{}"}})",
+                    stringField(payload, "cmd"), stringField(payload, "nonce")
+                ));
+
+                std::lock_guard lock(m_mutex);
+                m_commands.push_back(std::move(payload));
+                m_changed.notify_all();
+            }
+        }
+        m_input.erase(0, offset);
+    }
+
+    /// Waits until a command containing `text` was sent over the `connection`th connection (counting from 1)
+    bool waitForCommand(size_t connection, std::string_view text) {
+        std::unique_lock lock(m_mutex);
+        return m_changed.wait_for(lock, std::chrono::seconds(5), [&] {
+            return m_connections == connection && std::ranges::any_of(m_commands, [&](std::string const& command) {
+                return command.find(text) != std::string::npos;
+            });
+        });
+    }
+
+private:
+    static constexpr std::string_view Ready = R"({"cmd":"DISPATCH","data":{"v":1,"user":{"id":"1045800378228281345",)"
+        R"("username":"loopback","discriminator":"0","global_name":null,"avatar":null,"bot":false,"flags":0,)"
+        R"("premium_type":0}},"evt":"READY","nonce":null})";
+
+    /// Value of a string field, good enough for the commands the library writes
+    static std::string_view stringField(std::string_view json, std::string_view key) {
+        auto start = json.find(fmt::format(R"("{}":")", key));
+        if (start == std::string_view::npos) {
+            return {};
+        }
+        json.remove_prefix(start + key.size() + 4);
+        return json.substr(0, json.find('"'));
+    }
+
+    std::string m_input; ///< Only used on the library's thread
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::vector<std::string> m_commands;
+    size_t m_connections = 0;
+};
+
+/// Drives the manager through the loopback transport: handshake, a command, a presence,
+/// and the presence sent again after Discord dropped the connection
+static void testLoopbackSession() {
+    discord::LoopbackTransport transport;
+    SimulatedDiscord simulated;
+    transport.setPeerHandler([&simulated](discord::LoopbackTransport& transport) { simulated(transport); });
+
+    std::promise<void> ready;
+    auto& rpc = discord::RPCManager::get();
+    rpc.setClientID(APPLICATION_ID)
+        .setTransport(&transport)
+        .setRateLimit(0, {})
+        .onReady([&](discord::User const&) { ready.set_value(); });
+    rpc.initialize();
+
+    bool connected = ready.get_future().wait_for(std::chrono::seconds(5)) == std::future_status::ready;
+    CHECK(connected);
+    rpc.onReady(nullptr);
+    if (connected) {
+        auto response = rpc.sendCommand("GET_SELECTED_VOICE_CHANNEL").get();
+        CHECK(response.status == discord::CommandResponse::Status::Success);
+        CHECK(simulated.waitForCommand(1, R"("cmd":"GET_SELECTED_VOICE_CHANNEL")"));
+
+        rpc.getPresence().setState("Loopback presence");
+        rpc.refresh();
+        CHECK(simulated.waitForCommand(1, "Loopback presence"));
+
+        // a healthy connection reconnects right away, the presence goes out again without a refresh
+        transport.peerClose();
+        CHECK(simulated.waitForCommand(2, "Loopback presence"));
+        CHECK(transport.connections() == 2);
+    }
+
+    rpc.setTransport(nullptr);
+    rpc.shutdown();
+    rpc.getPresence().clear();
+}
+
+static int runUnitTests() {
+    testQueueWraparound();
+    testQueueOverflowSlot();
+    testQueueCoalescing();
+    testQueueLentActivity();
+    testQueueProducers();
+    testQueuePolicies();
+    testPresenceSerialization();
+    testLoopbackSession();
+
+    fmt::println("{}", Failures == 0 ? "All tests passed" : fmt::format("{} checks failed", Failures));
+    return Failures == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && std::string_view(argv[1]) == "--unit") {
+        return runUnitTests();
+    }
+
     discordSetup();
     discord::RPCManager::get().initialize();
 